@@ -0,0 +1,44 @@
+// Copyright 2024 Rik Essenius
+// 
+// Licensed under the Apache License, Version 2.0 (the "License"); you may not use this file
+// except in compliance with the License. You may obtain a copy of the License at
+// 
+//     http://www.apache.org/licenses/LICENSE-2.0
+// 
+// Unless required by applicable law or agreed to in writing, software distributed under the License
+// is distributed on an "AS IS" BASIS WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and limitations under the License.
+
+#include "AsyncLoader.h"
+
+namespace Esp32NetConfig {
+
+    AsyncLoader::AsyncLoader(std::function<void(AsyncLoader&)> load) {
+        _load = std::async(std::launch::async, [this, load] {
+            load(*this);
+            std::lock_guard<std::mutex> lock(_mutex);
+            _isLoading = false;
+            _sectionReady.notify_all();
+        }).share();
+    }
+
+    AsyncLoader::~AsyncLoader() {
+        wait();
+    }
+
+    void AsyncLoader::markReady(const Section section) {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _readySections |= 1 << static_cast<uint8_t>(section);
+        _sectionReady.notify_all();
+    }
+
+    void AsyncLoader::waitForSection(const Section section) {
+        const auto mask = static_cast<uint8_t>(1 << static_cast<uint8_t>(section));
+        std::unique_lock<std::mutex> lock(_mutex);
+        _sectionReady.wait(lock, [this, mask] { return (_readySections & mask) != 0 || !_isLoading; });
+    }
+
+    void AsyncLoader::wait() const {
+        _load.wait();
+    }
+}
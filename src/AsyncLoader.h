@@ -0,0 +1,44 @@
+// Copyright 2024 Rik Essenius
+// 
+// Licensed under the Apache License, Version 2.0 (the "License"); you may not use this file
+// except in compliance with the License. You may obtain a copy of the License at
+// 
+//     http://www.apache.org/licenses/LICENSE-2.0
+// 
+// Unless required by applicable law or agreed to in writing, software distributed under the License
+// is distributed on an "AS IS" BASIS WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and limitations under the License.
+
+// Runs the background load of Configuration::beginAsync() and tracks which sections it finished. Internal to the library.
+
+#ifndef HEADER_ASYNC_LOADER
+#define HEADER_ASYNC_LOADER
+
+#include <condition_variable>
+#include <functional>
+#include <future>
+#include <mutex>
+#include "Configuration.h"
+
+namespace Esp32NetConfig {
+    class AsyncLoader {
+    public:
+        // Runs the load on a background thread. It calls markReady() for each section it loaded.
+        explicit AsyncLoader(std::function<void(AsyncLoader&)> load);
+        AsyncLoader(const AsyncLoader&) = delete;
+        AsyncLoader& operator=(const AsyncLoader&) = delete;
+        ~AsyncLoader();
+        void markReady(Section section);
+        // Returns when the section is ready, or when the load finished without it.
+        void waitForSection(Section section);
+        // Returns when the load finished.
+        void wait() const;
+    private:
+        std::mutex _mutex;
+        std::condition_variable _sectionReady;
+        uint8_t _readySections = 0;
+        bool _isLoading = true;
+        std::shared_future<void> _load;
+    };
+}
+#endif
@@ -9,176 +9,1742 @@
 // is distributed on an "AS IS" BASIS WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
 // See the License for the specific language governing permissions and limitations under the License.
 
-#include <SafeCString.h>
+#include <Arduino.h>
+#include <algorithm>
+#include <cstddef>
+#include <cstring>
+#include <memory>
 #include "Configuration.h"
+#include "AsyncLoader.h"
+#include "ConfigurationKeys.h"
+#include "Pem.h"
 
 namespace Esp32NetConfig {
 
-    Configuration::Configuration(Preferences* preferences) : _preferences(preferences) {}
+    constexpr size_t Configuration::MaxPackedStringLength;
+    constexpr unsigned int Configuration::WriteFailed;
 
-    constexpr auto Ip = "ip";
+    Configuration::Configuration(Preferences* preferences, const StorageMode storageMode) :
+        Configuration(preferences, new char[DefaultBufferSize](), DefaultBufferSize, storageMode) {
+        _ownedBuffer.reset(_buffer);
+    }
+
+    Configuration::Configuration(Preferences* preferences, char* buffer, const size_t bufferSize, const StorageMode storageMode) :
+        _preferences{ preferences, 0, 0 }, _storageMode(storageMode), _buffer(buffer), _bufferSize(bufferSize), _next(buffer) {}
+
+    Configuration::~Configuration() {
+        // the background load uses the buffer and the Preferences object
+        waitForLoad();
+    }
+
+    Preferences* Configuration::CountedPreferences::operator->() const {
+        operations++;
+        return preferences;
+    }
 
-    constexpr auto Local = "local";
-    constexpr auto Gateway = "gateway";
-    constexpr auto SubnetMask = "subnetMask";
-    constexpr auto Dns1 = "dns1";
-    constexpr auto Dns2 = "dns2";
+    // Packed layout: version (1 byte), flags (1), reserved (2), generation (4), IP addresses (5 x 4), MQTT port (4), 
+    // BSSID (6), section generations (5 x 4, indexed by Section), followed by the strings. Each string is a 2-byte length including the terminator (0 means nullptr),
+    // followed by the characters and the terminator, so the strings can be used directly once the blob is in _buffer.
+    // After the strings come the records: a tag (1 byte), the length of the data (2) and the data. They hold what is not part
+    // of a section (the Wi-Fi profiles and the endpoints, in the layouts below), so begin() only needs the blob. Readers skip
+    // tags they don't know, and images have no records.
+    // Numbers are in native (little endian) byte order. Version 1 had no section generations; it can still be read.
+    constexpr uint8_t PackedVersion = 2;
+    constexpr uint8_t PackedVersionWithoutSectionGenerations = 1;
+    constexpr uint8_t HasBssidFlag = 0x01;
+    constexpr uint8_t UseTlsFlag = 0x02;
+    constexpr size_t FlagsOffset = 1;
+    constexpr size_t GenerationOffset = 4;
+    constexpr size_t IpOffset = 8;
+    constexpr size_t IpCount = 5;
+    constexpr size_t PortOffset = IpOffset + IpCount * sizeof(uint32_t);
+    constexpr size_t BssidOffset = PortOffset + sizeof(uint32_t);
+    constexpr size_t SectionGenerationsOffset = BssidOffset + BssidSize;
+    constexpr size_t StringsOffsetWithoutSectionGenerations = SectionGenerationsOffset;
+    constexpr size_t StringsOffset = SectionGenerationsOffset + SectionCount * sizeof(uint32_t);
+    constexpr size_t StringLengthSize = sizeof(uint16_t);
+    constexpr uint8_t ProfilesRecord = 1;
+    constexpr uint8_t MqttEndpointRecord = 2;
+    constexpr uint8_t FirmwareEndpointRecord = 3;
+    constexpr size_t RecordHeaderSize = 1 + sizeof(uint16_t);
 
-    constexpr auto Mqtt = "mqtt";
-    constexpr auto Broker = "broker";
-    constexpr auto Port = "port";
-    constexpr auto User = "user";
-    constexpr auto Password = "password";
-    constexpr auto UseTls = "useTls";
+    // Wi-Fi profiles layout: version (1 byte), count (1), and for each profile: flags (1), channel (1), successes (2), 
+    // failures (2), last success (4), BSSID (6), followed by the SSID and the password, each as a 1-byte length 
+    // including the terminator (0 means nullptr) and the characters with the terminator. Loaded in place like the packed blob.
+    constexpr uint8_t ProfilesVersion = 1;
+    constexpr size_t ProfilesHeaderSize = 2;
+    constexpr uint8_t ProfileHasBssidFlag = 0x01;
+    constexpr size_t ProfileChannelOffset = 1;
+    constexpr size_t ProfileSuccessesOffset = 2;
+    constexpr size_t ProfileFailuresOffset = 4;
+    constexpr size_t ProfileLastSuccessOffset = 6;
+    constexpr size_t ProfileBssidOffset = 10;
+    constexpr size_t ProfileFixedSize = ProfileBssidOffset + BssidSize;
+    constexpr size_t MaxProfileStringSize = 255;
 
-    constexpr auto Wifi = "wifi";
-    constexpr auto DeviceName = "deviceName";
-    constexpr auto Ssid = "ssid";
-    constexpr auto Bssid = "bssid";
+    // DHCP lease layout: version (1 byte), the five IP addresses (4 each), expiry (4), BSSID (6)
+    constexpr uint8_t LeaseVersion = 1;
+    constexpr size_t LeaseExpiryOffset = 1 + IpCount * sizeof(uint32_t);
+    constexpr size_t LeaseBssidOffset = LeaseExpiryOffset + sizeof(uint32_t);
+    constexpr size_t LeaseSize = LeaseBssidOffset + BssidSize;
 
-    constexpr auto Tls = "tls";
-    constexpr auto RootCaCert = "rootCaCert";
-    constexpr auto DeviceCert = "deviceCert";
-    constexpr auto DeviceKey = "deviceKey";
+    // Endpoint layout: version (1 byte), hash of what it was parsed from (4), port (2), address (4), address expiry (4),
+    // followed by the scheme, the host and the path, each with a terminator. Loaded in place like the profiles.
+    constexpr uint8_t EndpointVersion = 1;
+    constexpr size_t EndpointHashOffset = 1;
+    constexpr size_t EndpointPortOffset = 5;
+    constexpr size_t EndpointAddressOffset = 7;
+    constexpr size_t EndpointExpiryOffset = 11;
+    constexpr size_t EndpointStringsOffset = 15;
+    constexpr auto MqttScheme = "mqtt";
+    constexpr auto MqttTlsScheme = "mqtts";
+    constexpr auto FirmwareScheme = "http";
 
-    constexpr auto Firmware = "firmware";
-    constexpr auto Url = "url";
+    struct SchemePort {
+        const char* scheme;
+        uint16_t port;
+    };
+    constexpr SchemePort SchemePorts[] = { { "http", 80 }, { "https", 443 }, { MqttScheme, DefaultMqttPort }, { MqttTlsScheme, 8883 } };
 
-    void Configuration::begin() {
-        getIpConfig();
-        _next = getWifiConfig(_buffer);
-        _next = getTlsConfig(_next);
-        _next = getMqttConfig(_next);
-        getFirmwareConfig(_next);
+    uint16_t mqttPort(const MqttConfig& mqttConfig) {
+        return static_cast<uint16_t>(mqttConfig.port == 0 ? DefaultMqttPort : mqttConfig.port);
     }
 
-    int Configuration::freeBufferSpace() const {
-        return BufferSize - static_cast<int>(_next - _buffer);
+    void Configuration::begin(const LoadMode loadMode) {
+        waitForLoad();
+        _asyncLoader.reset();
+        load(loadMode);
+    }
+
+    void Configuration::load(const LoadMode loadMode) {
+        _loadMode = loadMode;
+        _next = _buffer;
+        _loadedSections = 0;
+        _truncatedSections = 0;
+        _isBlobTruncated = false;
+        // the buffer is reused, so nothing may point into it until its section is loaded again
+        ip = {};
+        wifi = {};
+        tls = {};
+        mqtt = {};
+        firmware = {};
+        tlsDer = {};
+        wifiProfileCount = 0;
+        mqttEndpoint = {};
+        firmwareEndpoint = {};
+        if (_storageMode == StorageMode::Packed) {
+            const auto measurement = startMeasurement();
+            _isTruncated = false;
+            const auto isLoaded = loadPacked();
+            recordLoad(_stats.packed, measurement, _buffer);
+            // the per-key namespaces are empty once there is a blob
+            _isBlobTruncated = _isTruncated;
+            if (isLoaded) {
+                _loadedSections = AllSections;
+                loadUserSections();
+                return;
+            }
+        }
+        if (loadMode == LoadMode::Eager) {
+            for (uint8_t index = 0; index < SectionCount; index++) loadSection(static_cast<Section>(index));
+        }
+        loadUserSections();
+    }
+
+    void Configuration::beginAsync() {
+        waitForLoad();
+        _asyncLoader.reset(new AsyncLoader([this](AsyncLoader& loader) {
+            // loads everything in packed mode, and nothing but the application sections per key
+            load(LoadMode::Lazy);
+            for (uint8_t index = 0; index < SectionCount; index++) {
+                const auto section = static_cast<Section>(index);
+                if (!isLoaded(section)) loadSection(section);
+                loader.markReady(section);
+            }
+            _loadMode = LoadMode::Eager;
+        }));
+    }
+
+    void Configuration::waitForSection(const Section section) {
+        if (_asyncLoader != nullptr) _asyncLoader->waitForSection(section);
+    }
+
+    void Configuration::waitForLoad() const {
+        if (_asyncLoader != nullptr) _asyncLoader->wait();
+    }
+
+    bool Configuration::addSection(const SectionDescriptor* section, void* data) {
+        waitForLoad();
+        if (section == nullptr || data == nullptr || _userSectionCount == MaxUserSections) return false;
+        _userSections[_userSectionCount++] = { section, data };
+        return true;
+    }
+
+    void Configuration::attachImage(const ConfigurationImage* image) {
+        waitForLoad();
+        _image = image;
+    }
+
+    bool Configuration::adoptSection(const Section section, const Configuration& source) {
+        // reuse the section's space if nothing was added after it
+        const auto index = static_cast<uint8_t>(section);
+        if (_sectionEnd[index] == _next) _next = _sectionStart[index];
+        const auto start = _next;
+        _isTruncated = false;
+        copyFields(BuiltInSections[index], source.sectionData(section), sectionData(section), true);
+        if (section == Section::Tls) tlsDer = {};
+        copyRecords(section, source);
+        _sectionGeneration[index] = source._sectionGeneration[index];
+        _sectionStart[index] = start;
+        _sectionEnd[index] = _next;
+        if (!_isTruncated) _truncatedSections &= ~(1 << index);
+        return !_isTruncated;
+    }
+
+    void Configuration::clearSection(const Section section) const {
+        // the Wi-Fi profiles and the DHCP lease are not part of their section, so they survive
+        const auto keptKey = SectionKeptKeys[static_cast<uint8_t>(section)];
+        std::vector<uint8_t> kept;
+        if (keptKey != nullptr) {
+            kept.resize(_preferences->getBytesLength(keptKey));
+            if (!kept.empty()) _preferences->getBytes(keptKey, kept.data(), kept.size());
+        }
+        _preferences->clear();
+        if (!kept.empty()) _preferences->putBytes(keptKey, kept.data(), kept.size());
+    }
+
+    void Configuration::copyRecords(const Section section, const Configuration& source) {
+        // the profiles and endpoints that come with the section, into the buffer like its values
+        switch (section) {
+        case Section::Wifi:
+            wifiProfileCount = source.wifiProfileCount;
+            for (uint8_t index = 0; index < wifiProfileCount; index++) {
+                auto& profile = wifiProfiles[index];
+                profile = source.wifiProfiles[index];
+                profile.ssid = copyString(profile.ssid);
+                profile.password = copyString(profile.password);
+                if (profile.bssid != nullptr) profile.bssid = reinterpret_cast<const uint8_t*>(copyToBuffer(profile.bssid, BssidSize));
+            }
+            break;
+        case Section::Mqtt:
+        case Section::Firmware: {
+            auto& endpoint = section == Section::Mqtt ? mqttEndpoint : firmwareEndpoint;
+            endpoint = section == Section::Mqtt ? source.mqttEndpoint : source.firmwareEndpoint;
+            for (const auto part : { &endpoint.scheme, &endpoint.host, &endpoint.path }) *part = copyString(*part);
+            break;
+        }
+        default:
+            break;
+        }
+    }
+
+    void Configuration::copyFields(const SectionDescriptor& section, const void* source, void* target, const bool isIntoBuffer) {
+        // into the buffer for values that must not depend on the source's buffer, else only the pointers
+        const auto from = static_cast<const char*>(source);
+        const auto to = static_cast<char*>(target);
+        for (uint8_t index = 0; index < section.fieldCount; index++) {
+            const auto& field = section.fields[index];
+            switch (field.type) {
+            case FieldType::Address:
+                *reinterpret_cast<IPAddress*>(to + field.offset) = *reinterpret_cast<const IPAddress*>(from + field.offset);
+                break;
+            case FieldType::UInt:
+                *reinterpret_cast<unsigned int*>(to + field.offset) = *reinterpret_cast<const unsigned int*>(from + field.offset);
+                break;
+            case FieldType::Bool:
+                *reinterpret_cast<bool*>(to + field.offset) = *reinterpret_cast<const bool*>(from + field.offset);
+                break;
+            case FieldType::String:
+            case FieldType::Certificate: {
+                const auto value = *reinterpret_cast<const char* const*>(from + field.offset);
+                *reinterpret_cast<const char**>(to + field.offset) = isIntoBuffer ? copyString(value) : value;
+                break;
+            }
+            case FieldType::Bssid: {
+                const auto value = *reinterpret_cast<const uint8_t* const*>(from + field.offset);
+                *reinterpret_cast<const uint8_t**>(to + field.offset) = isIntoBuffer && value != nullptr 
+                    ? reinterpret_cast<const uint8_t*>(copyToBuffer(value, BssidSize)) 
+                    : value;
+                break;
+            }
+            }
+        }
+    }
+
+    bool Configuration::buildImage(std::vector<uint8_t>& image) {
+        waitForLoad();
+        for (uint8_t section = 0; section < SectionCount; section++) {
+            if (!isLoaded(static_cast<Section>(section))) loadSection(static_cast<Section>(section));
+        }
+        // the image holds PEM, like the blob
+        rebuildPem();
+        return pack(image, false);
+    }
+
+    bool Configuration::buildImage(const IpConfig& ipConfig, const WifiConfig& wifiConfig, const TlsConfig& tlsConfig,
+                                   const MqttConfig& mqttConfig, const FirmwareConfig& firmwareConfig, std::vector<uint8_t>& image) {
+        // packing only uses the sections, not the Preferences or the buffer
+        Configuration packer(nullptr, nullptr, 0);
+        packer.ip = ipConfig;
+        packer.wifi = wifiConfig;
+        packer.tls = tlsConfig;
+        packer.mqtt = mqttConfig;
+        packer.firmware = firmwareConfig;
+        return packer.pack(image, false);
+    }
+
+    const char* Configuration::copyString(const char* value) {
+        return value == nullptr ? nullptr : copyToBuffer(value, strlen(value) + 1);
+    }
+
+    char* Configuration::copyToBuffer(const void* value, const size_t size) {
+        if (size > static_cast<size_t>(_buffer + _bufferSize - _next)) {
+            _isTruncated = true;
+            return nullptr;
+        }
+        const auto target = _next;
+        memcpy(target, value, size);
+        _next += size;
+        return target;
+    }
+
+    unsigned int Configuration::countWrite(const bool isWritten) const {
+        if (!isWritten) _preferences.writeFailures++;
+        return isWritten ? 1 : 0;
+    }
+
+    DerObject& Configuration::derObject(const uint8_t index) {
+        // same order as the Certificate fields in the TLS section
+        DerObject* const objects[] = { &tlsDer.rootCaCertificate, &tlsDer.deviceCertificate, &tlsDer.devicePrivateKey };
+        return *objects[index];
+    }
+
+    FieldType Configuration::effectiveType(const SectionDescriptor& section, const FieldDescriptor& field) {
+        // only the TLS section has DER keys for its certificates
+        const bool isTls = &section == &BuiltInSections[static_cast<uint8_t>(Section::Tls)];
+        return field.type == FieldType::Certificate && !isTls ? FieldType::String : field.type;
+    }
+
+    const FirmwareConfig& Configuration::firmwareConfig() {
+        if (!isLoadedAsync(Section::Firmware) && !isLoaded(Section::Firmware)) loadSection(Section::Firmware);
+        return firmware;
+    }
+
+    const IpConfig& Configuration::ipConfig() {
+        if (!isLoadedAsync(Section::Ip) && !isLoaded(Section::Ip)) loadSection(Section::Ip);
+        return ip;
+    }
+
+    const Endpoint& Configuration::endpoint(const Section section) {
+        static const Endpoint NoEndpoint{};
+        if (section == Section::Mqtt) {
+            mqttConfig();
+            return mqttEndpoint;
+        }
+        if (section == Section::Firmware) {
+            firmwareConfig();
+            return firmwareEndpoint;
+        }
+        return NoEndpoint;
+    }
+
+    const MqttConfig& Configuration::mqttConfig() {
+        if (!isLoadedAsync(Section::Mqtt) && !isLoaded(Section::Mqtt)) loadSection(Section::Mqtt);
+        return mqtt;
+    }
+
+    const TlsConfig& Configuration::tlsConfig() {
+        // the PEM text goes at the end of the buffer, where the background load adds its sections
+        waitForLoad();
+        tlsDerConfig();
+        rebuildPem();
+        return tls;
+    }
+
+    const TlsDerConfig& Configuration::tlsDerConfig() {
+        // the certificates are only needed (and read) if MQTT uses TLS
+        if (!isLoadedAsync(Section::Tls) && !isLoaded(Section::Tls) && mqttConfig().useTls) loadSection(Section::Tls);
+        return tlsDer;
+    }
+
+    const WifiConfig& Configuration::wifiConfig() {
+        if (!isLoadedAsync(Section::Wifi) && !isLoaded(Section::Wifi)) loadSection(Section::Wifi);
+        return wifi;
+    }
+
+    void Configuration::notifyChanges(const uint8_t changedSections) {
+        for (uint8_t index = 0; index < SectionCount; index++) {
+            if ((changedSections & (1 << index)) == 0) continue;
+            for (const auto& handler : _changeHandlers[index]) handler();
+        }
+    }
+
+    void Configuration::onChange(const Section section, std::function<void()> handler) {
+        _changeHandlers[static_cast<uint8_t>(section)].push_back(std::move(handler));
+    }
+
+    unsigned int Configuration::reload() {
+        waitForLoad();
+        uint8_t changedSections;
+        if (_storageMode == StorageMode::Packed) {
+            // the blob is read anyway, so read it into a separate buffer and take only the changed sections from it
+            const auto latestSize = requiredBufferSize(_preferences.preferences, StorageMode::Packed);
+            std::unique_ptr<char[]> latestBuffer(new char[latestSize]);
+            Configuration latest(_preferences.preferences, latestBuffer.get(), latestSize, StorageMode::Packed);
+            const bool hasBlob = latest.loadPacked();
+            _preferences.operations += latest._preferences.operations;
+            changedSections = hasBlob ? reloadPacked(latest) : reloadPerKey();
+        }
+        else {
+            changedSections = reloadPerKey();
+        }
+        notifyChanges(changedSections);
+        unsigned int changeCount = 0;
+        for (uint8_t index = 0; index < SectionCount; index++) {
+            if ((changedSections & (1 << index)) != 0) changeCount++;
+        }
+        return changeCount;
+    }
+
+    uint8_t Configuration::reloadPacked(const Configuration& latest) {
+        uint8_t changedSections = 0;
+        for (uint8_t index = 0; index < SectionCount; index++) {
+            if (isLoaded(static_cast<Section>(index)) && latest._sectionGeneration[index] != _sectionGeneration[index]) {
+                changedSections |= 1 << index;
+            }
+        }
+        for (uint8_t index = 0; index < SectionCount; index++) {
+            if ((changedSections & (1 << index)) == 0) continue;
+            if (!adoptSection(static_cast<Section>(index), latest)) {
+                const auto loadedSections = _loadedSections;
+                begin(_loadMode);
+                return loadedSections;
+            }
+        }
+        _generation = latest._generation;
+        return changedSections;
+    }
+
+    uint8_t Configuration::reloadPerKey() {
+        uint8_t changedSections = 0;
+        for (uint8_t index = 0; index < SectionCount; index++) {
+            const auto section = static_cast<Section>(index);
+            if (isLoaded(section) && storedGeneration(section) != _sectionGeneration[index]) {
+                changedSections |= 1 << index;
+            }
+        }
+        for (uint8_t index = 0; index < SectionCount; index++) {
+            if ((changedSections & (1 << index)) == 0) continue;
+            // reuse the section's space if nothing was added after it
+            if (_sectionEnd[index] == _next) _next = _sectionStart[index];
+            loadSection(static_cast<Section>(index));
+            if (_isTruncated) {
+                const auto loadedSections = _loadedSections;
+                begin(_loadMode);
+                return loadedSections;
+            }
+        }
+        return changedSections;
+    }
+
+    size_t Configuration::requiredBufferSize(Preferences* preferences, const StorageMode storageMode) {
+        // a dry run of begin() that adds up the sizes instead of loading
+        Configuration sizer(preferences, nullptr, 0, storageMode);
+        sizer._isDryRun = true;
+        sizer.begin();
+        return sizer._requiredSize;
+    }
+
+    bool Configuration::isLoadedAsync(const Section section) {
+        if (_asyncLoader == nullptr) return false;
+        _asyncLoader->waitForSection(section);
+        return true;
     }
 
-    char* Configuration::getFirmwareConfig(char* start) {
-        _preferences->begin(Firmware, true);
-        firmware.baseUrl = storeToBuffer(Url, &start);
+    bool Configuration::isLoaded(const Section section) const {
+        return (_loadedSections & (1 << static_cast<uint8_t>(section))) != 0;
+    }
+
+    void Configuration::loadSection(const Section section) {
+        const auto measurement = startMeasurement();
+        const auto start = _next;
+        _isTruncated = false;
+        const auto index = static_cast<uint8_t>(section);
+        _preferences->begin(SectionNamespaces[index], true);
+        // a section that was put has a generation
+        const bool isFromImage = _image != nullptr && !_preferences->isKey(Generation) && 
+            parsePacked(_image->data(), _image->size(), static_cast<uint8_t>(1 << index)) != 0;
+        if (!isFromImage) _next = loadFields(BuiltInSections[index], sectionData(section), _next);
+        if (_isTruncated || _isBlobTruncated) {
+            _truncatedSections |= 1 << index;
+        }
+        else {
+            _truncatedSections &= ~(1 << index);
+        }
+        _next = storeExtrasToBuffer(section, _next);
+        _sectionGeneration[index] = _preferences->getUInt(Generation, 0);
         _preferences->end();
-        return start;
+        _sectionStart[index] = start;
+        _sectionEnd[index] = _next;
+        _loadedSections |= 1 << index;
+        recordLoad(_stats.section[index], measurement, start);
     }
 
-    void Configuration::getIpConfig() {
-        _preferences->begin(Ip, true);
-        ip.localIp = _preferences->getUInt(Local, 0);
-        ip.gateway = _preferences->getUInt(Gateway, 0);
-        ip.subnetMask = _preferences->getUInt(SubnetMask, 0);
-        ip.primaryDns = _preferences->getUInt(Dns1, 0);
-        ip.secondaryDns = _preferences->getUInt(Dns2, 0);
+    void* Configuration::sectionData(const Section section) {
+        void* const data[] = { &ip, &wifi, &tls, &mqtt, &firmware };
+        return data[static_cast<uint8_t>(section)];
+    }
+
+    const void* Configuration::sectionData(const Section section) const {
+        return const_cast<Configuration*>(this)->sectionData(section);
+    }
+
+    Configuration::Measurement Configuration::startMeasurement() const {
+        return { micros(), _preferences.operations, _preferences.writeFailures };
+    }
+
+    void Configuration::recordLoad(SectionStats& stats, const Measurement& measurement, const char* start) {
+        stats.loadMicros = static_cast<uint32_t>(micros() - measurement.startMicros);
+        stats.loadOperations = _preferences.operations - measurement.startOperations;
+        stats.bufferBytes = static_cast<uint32_t>(_next - start);
+        stats.truncated = _isTruncated;
+    }
+
+    void Configuration::recordStore(SectionStats& stats, const Measurement& measurement, const unsigned int keysWritten) const {
+        stats.storeMicros = static_cast<uint32_t>(micros() - measurement.startMicros);
+        stats.storeOperations = _preferences.operations - measurement.startOperations;
+        stats.keysWritten = keysWritten;
+        stats.writeFailures = _preferences.writeFailures - measurement.startWriteFailures;
+    }
+
+    const ConfigurationStats& Configuration::stats() const {
+        waitForLoad();
+        return _stats;
+    }
+
+    Configuration::Transaction Configuration::beginTransaction() const {
+        waitForLoad();
+        return Transaction(this);
+    }
+
+    Configuration::Importer Configuration::beginImport() const {
+        waitForLoad();
+        return Importer(this);
+    }
+
+    Configuration::Exporter Configuration::beginExport() {
+        waitForLoad();
+        return Exporter(this);
+    }
+
+    bool Configuration::get(const char* name, char* value, const size_t size) {
+        const auto number = findField(name);
+        if (number == BuiltInFieldCount || value == nullptr) return false;
+        const auto section = static_cast<Section>(sectionOf(number));
+        waitForLoad();
+        if (!isLoaded(section)) loadSection(section);
+        // the text of a certificate is PEM, also if it is stored as DER
+        if (section == Section::Tls) rebuildPem();
+        const auto& field = BuiltInFields[number];
+        return formatValue(field.type, static_cast<const char*>(sectionData(section)) + field.offset, value, size);
+    }
+
+    bool Configuration::set(const char* name, const char* value) {
+        const auto number = findField(name);
+        if (number == BuiltInFieldCount) return false;
+        const auto index = sectionOf(number);
+        const auto section = static_cast<Section>(index);
+        const auto field = static_cast<uint8_t>(number - (BuiltInSections[index].fields - BuiltInFields));
+        IpConfig ipConfig{};
+        WifiConfig wifiConfig{};
+        TlsConfig tlsConfig{};
+        MqttConfig mqttConfig{};
+        FirmwareConfig firmwareConfig{};
+        void* const values[] = { &ipConfig, &wifiConfig, &tlsConfig, &mqttConfig, &firmwareConfig };
+        uint8_t bssid[BssidSize];
+        const auto& descriptor = BuiltInFields[number];
+        if (!parseField(number, value, static_cast<char*>(values[index]) + descriptor.offset, bssid)) return false;
+        // a background load uses the Preferences object
+        waitForLoad();
+
+        if (_storageMode == StorageMode::Packed) {
+            return putPacked(section == Section::Ip ? &ipConfig : nullptr, section == Section::Wifi ? &wifiConfig : nullptr,
+                             section == Section::Tls ? &tlsConfig : nullptr, section == Section::Mqtt ? &mqttConfig : nullptr,
+                             section == Section::Firmware ? &firmwareConfig : nullptr, field) != WriteFailed;
+        }
+        // A section that is still in the image is written as a whole, so it needs the other values from the image.
+        // The endpoint needs the broker or URL, the port and the TLS flag as they are stored now.
+        // Neither needs a buffer: the values point into the image, or are read from Preferences.
+        void* data = values[index];
+        std::unique_ptr<Configuration> imageView;
+        String source;
+        _preferences->begin(SectionNamespaces[index], true);
+        if (_image != nullptr && !_preferences->isKey(Generation)) {
+            imageView.reset(new Configuration(_preferences.preferences, nullptr, 0));
+            if (imageView->parsePacked(_image->data(), _image->size(), static_cast<uint8_t>(1 << index)) != 0) {
+                const SectionDescriptor changed{ BuiltInSections[index].name, &descriptor, 1 };
+                imageView->copyFields(changed, data, imageView->sectionData(section), false);
+                data = imageView->sectionData(section);
+            }
+        }
+        else if (section == Section::Mqtt) {
+            if (descriptor.offset != offsetof(MqttConfig, broker) && _preferences->isKey(Broker)) {
+                source = _preferences->getString(Broker);
+                mqttConfig.broker = source.c_str();
+            }
+            if (descriptor.offset != offsetof(MqttConfig, port)) mqttConfig.port = _preferences->getUInt(Port, 0);
+            // with the defaults of loadFields: TLS by default if the port is not the default
+            if (descriptor.offset != offsetof(MqttConfig, useTls)) mqttConfig.useTls = _preferences->getBool(UseTls, mqttPort(mqttConfig) != DefaultMqttPort);
+        }
+        else if (section == Section::Firmware && descriptor.offset != offsetof(FirmwareConfig, baseUrl) && _preferences->isKey(Url)) {
+            source = _preferences->getString(Url);
+            firmwareConfig.baseUrl = source.c_str();
+        }
         _preferences->end();
+        putSectionPerKey(section, data, CertificateFormat::Pem, field);
+        return _stats.section[index].writeFailures == 0;
     }
 
-    char* Configuration::getMqttConfig(char* start) {
-        _preferences->begin(Mqtt, true);
-        mqtt.broker = storeToBuffer(Broker, &start);
-        mqtt.port = _preferences->getUInt(Port, 1883);
-        mqtt.user = storeToBuffer(User, &start);
-        mqtt.password = storeToBuffer(Password, &start);
-        mqtt.useTls = _preferences->getBool(UseTls, mqtt.port != 1883);
+    int Configuration::freeBufferSpace() const {
+        waitForLoad();
+        return static_cast<int>(_bufferSize - (_next - _buffer));
+    }
+
+    uint32_t Configuration::generation() const {
+        waitForLoad();
+        return _generation;
+    }
+
+    uint32_t Configuration::generation(const Section section) const {
+        waitForLoad();
+        return _sectionGeneration[static_cast<uint8_t>(section)];
+    }
+
+    uint32_t Configuration::storedGeneration(const Section section) const {
+        _preferences->begin(SectionNamespaces[static_cast<uint8_t>(section)], true);
+        const auto generation = _preferences->getUInt(Generation, 0);
         _preferences->end();
+        return generation;
+    }
+
+    char* Configuration::loadFields(const SectionDescriptor& section, void* data, char* start) {
+        // the namespace is open
+        const auto base = static_cast<char*>(data);
+        for (uint8_t index = 0; index < section.fieldCount; index++) {
+            const auto& field = section.fields[index];
+            const auto member = base + field.offset;
+            switch (effectiveType(section, field)) {
+            case FieldType::Address:
+                *reinterpret_cast<IPAddress*>(member) = _preferences->getUInt(field.key, field.defaultValue);
+                break;
+            case FieldType::UInt:
+                *reinterpret_cast<unsigned int*>(member) = _preferences->getUInt(field.key, field.defaultValue);
+                break;
+            case FieldType::Bool: {
+                auto defaultValue = field.defaultValue != 0;
+                if (field.defaultIfChangedField != 0) {
+                    const auto& other = section.fields[field.defaultIfChangedField - 1];
+                    defaultValue = *reinterpret_cast<const unsigned int*>(base + other.offset) != other.defaultValue;
+                }
+                *reinterpret_cast<bool*>(member) = _preferences->getBool(field.key, defaultValue);
+                break;
+            }
+            case FieldType::String:
+                *reinterpret_cast<const char**>(member) = storeToBuffer(field.key, &start);
+                break;
+            case FieldType::Bssid:
+                *reinterpret_cast<const uint8_t**>(member) = reinterpret_cast<const uint8_t*>(storeBytesToBuffer(field.key, BssidSize, &start));
+                break;
+            case FieldType::Certificate:
+                *reinterpret_cast<const char**>(member) = storeCertificateToBuffer(field.key, CertificateDerKeys[index], derObject(index), &start);
+                break;
+            }
+        }
         return start;
     }
 
-    char* Configuration::getTlsConfig(char* start) {
-        _preferences->begin(Tls, true);
-        tls.rootCaCertificate = storeToBuffer(RootCaCert, &start);
-        tls.deviceCertificate = storeToBuffer(DeviceCert, &start);
-        tls.devicePrivateKey = storeToBuffer(DeviceKey, &start);
+    void Configuration::loadUserSections() {
+        // after the built-in sections, so they share the buffer; not included in requiredBufferSize
+        for (uint8_t index = 0; index < _userSectionCount; index++) {
+            const auto& userSection = _userSections[index];
+            _preferences->begin(userSection.descriptor->name, true);
+            _next = loadFields(*userSection.descriptor, userSection.data, _next);
+            _preferences->end();
+        }
+    }
+
+    bool Configuration::loadPacked() {
+        _preferences->begin(Config, true);
+        const auto size = _preferences->getBytesLength(Packed);
+        if (_isDryRun) {
+            _preferences->end();
+            _requiredSize = size;
+            return size >= StringsOffsetWithoutSectionGenerations;
+        }
+        _isTruncated = size > _bufferSize;
+        const bool isRead = size >= StringsOffsetWithoutSectionGenerations && !_isTruncated && 
+            _preferences->getBytes(Packed, _buffer, _bufferSize) == size;
         _preferences->end();
-        return start;
+        const auto recordsOffset = isRead ? parsePacked(_buffer, size, AllSections) : 0;
+        if (recordsOffset == 0) return false;
+        parseRecords(_buffer, recordsOffset, size);
+        const auto version = static_cast<uint8_t>(_buffer[0]);
+        memcpy(&_generation, _buffer + GenerationOffset, sizeof _generation);
+        if (version == PackedVersion) {
+            memcpy(_sectionGeneration, _buffer + SectionGenerationsOffset, sizeof _sectionGeneration);
+        }
+        else {
+            // without section generations, any change counts as a change of every section
+            for (auto& sectionGeneration : _sectionGeneration) sectionGeneration = _generation;
+        }
+        for (auto& sectionEnd : _sectionEnd) sectionEnd = nullptr;
+        _next = _buffer + size;
+        return true;
+    }
+
+    size_t Configuration::parsePacked(const char* blob, const size_t size, const uint8_t sections) {
+        // Points the fields of the sections straight into the blob, so it must stay where it is
+        if (size < StringsOffsetWithoutSectionGenerations) return 0;
+        const auto version = static_cast<uint8_t>(blob[0]);
+        if (version != PackedVersion && version != PackedVersionWithoutSectionGenerations) return 0;
+        if (version == PackedVersion && size < StringsOffset) return 0;
+
+        // same order as in pack()
+        const char** fields[] = { 
+            &wifi.deviceName, &wifi.ssid, &wifi.password, 
+            &tls.rootCaCertificate, &tls.deviceCertificate, &tls.devicePrivateKey,
+            &mqtt.broker, &mqtt.user, &mqtt.password, 
+            &firmware.baseUrl 
+        };
+        constexpr Section FieldSections[] = { 
+            Section::Wifi, Section::Wifi, Section::Wifi, 
+            Section::Tls, Section::Tls, Section::Tls, 
+            Section::Mqtt, Section::Mqtt, Section::Mqtt, 
+            Section::Firmware 
+        };
+        auto offset = version == PackedVersion ? StringsOffset : StringsOffsetWithoutSectionGenerations;
+        for (uint8_t index = 0; index < sizeof fields / sizeof fields[0]; index++) {
+            if (offset + StringLengthSize > size) return 0;
+            uint16_t length;
+            memcpy(&length, blob + offset, StringLengthSize);
+            offset += StringLengthSize;
+            if (length > 0 && (offset + length > size || blob[offset + length - 1] != 0)) return 0;
+            if ((sections & (1 << static_cast<uint8_t>(FieldSections[index]))) != 0) {
+                *fields[index] = length == 0 ? nullptr : blob + offset;
+            }
+            offset += length;
+        }
+
+        if ((sections & (1 << static_cast<uint8_t>(Section::Ip))) != 0) {
+            uint32_t addresses[IpCount];
+            memcpy(addresses, blob + IpOffset, sizeof addresses);
+            ip = { addresses[0], addresses[1], addresses[2], addresses[3], addresses[4] };
+        }
+        const auto flags = static_cast<uint8_t>(blob[FlagsOffset]);
+        if ((sections & (1 << static_cast<uint8_t>(Section::Mqtt))) != 0) {
+            uint32_t port;
+            memcpy(&port, blob + PortOffset, sizeof port);
+            mqtt.port = port;
+            mqtt.useTls = (flags & UseTlsFlag) != 0;
+        }
+        if ((sections & (1 << static_cast<uint8_t>(Section::Wifi))) != 0) {
+            // read-only if the blob is an image, like the strings
+            wifi.bssid = (flags & HasBssidFlag) != 0 ? reinterpret_cast<const uint8_t*>(blob + BssidOffset) : nullptr;
+        }
+        return offset;
+    }
+
+    void Configuration::parseRecords(char* blob, size_t offset, const size_t size) {
+        // after parsePacked, as the endpoints must match their sections
+        while (offset + RecordHeaderSize <= size) {
+            const auto tag = static_cast<uint8_t>(blob[offset]);
+            uint16_t length;
+            memcpy(&length, blob + offset + 1, sizeof length);
+            const auto data = blob + offset + RecordHeaderSize;
+            offset += RecordHeaderSize + length;
+            if (offset > size) return;
+            switch (tag) {
+            case ProfilesRecord:
+                wifiProfileCount = parseProfiles(data, length, wifiProfiles);
+                sortProfiles(wifiProfiles, wifiProfileCount);
+                break;
+            case MqttEndpointRecord:
+                useEndpoint(data, length, mqtt.broker, mqtt.useTls ? MqttTlsScheme : MqttScheme, mqttPort(mqtt), mqttEndpoint);
+                break;
+            case FirmwareEndpointRecord:
+                useEndpoint(data, length, firmware.baseUrl, FirmwareScheme, 0, firmwareEndpoint);
+                break;
+            default:
+                // written by a newer version
+                break;
+            }
+        }
+    }
+
+    bool Configuration::pack(std::vector<uint8_t>& blob, const bool isWithRecords) const {
+        blob.assign(StringsOffset, 0);
+        blob[0] = PackedVersion;
+        blob[FlagsOffset] = (wifi.bssid != nullptr ? HasBssidFlag : 0) | (mqtt.useTls ? UseTlsFlag : 0);
+        memcpy(&blob[GenerationOffset], &_generation, sizeof _generation);
+        const uint32_t addresses[IpCount] = { ip.localIp, ip.gateway, ip.subnetMask, ip.primaryDns, ip.secondaryDns };
+        memcpy(&blob[IpOffset], addresses, sizeof addresses);
+        // a port of 0 means "not set", which the per-key layout reads back as the default
+        const uint32_t port = mqtt.port == 0 ? DefaultMqttPort : mqtt.port;
+        memcpy(&blob[PortOffset], &port, sizeof port);
+        if (wifi.bssid != nullptr) {
+            memcpy(&blob[BssidOffset], wifi.bssid, BssidSize);
+        }
+        memcpy(&blob[SectionGenerationsOffset], _sectionGeneration, sizeof _sectionGeneration);
+
+        // same order as in loadPacked()
+        const char* values[] = { 
+            wifi.deviceName, wifi.ssid, wifi.password, 
+            tls.rootCaCertificate, tls.deviceCertificate, tls.devicePrivateKey,
+            mqtt.broker, mqtt.user, mqtt.password, 
+            firmware.baseUrl 
+        };
+        for (const auto value : values) {
+            const auto size = value == nullptr ? 0 : strlen(value) + 1;
+            if (size > MaxPackedStringLength + 1) return false;
+            const auto length = static_cast<uint16_t>(size);
+            const auto offset = blob.size();
+            blob.resize(offset + StringLengthSize + length);
+            memcpy(&blob[offset], &length, StringLengthSize);
+            if (length > 0) {
+                memcpy(&blob[offset + StringLengthSize], value, length);
+            }
+        }
+        if (!isWithRecords) return true;
+
+        std::vector<uint8_t> record;
+        if (wifiProfileCount > 0) {
+            packProfiles(wifiProfiles, wifiProfileCount, record);
+            if (!appendRecord(ProfilesRecord, record, blob)) return false;
+        }
+        if (mqtt.broker != nullptr && packEndpoint(mqtt.broker, mqtt.useTls ? MqttTlsScheme : MqttScheme, mqttPort(mqtt), record)) {
+            keepAddress(mqttEndpoint, record);
+            if (!appendRecord(MqttEndpointRecord, record, blob)) return false;
+        }
+        if (firmware.baseUrl != nullptr && packEndpoint(firmware.baseUrl, FirmwareScheme, 0, record)) {
+            keepAddress(firmwareEndpoint, record);
+            if (!appendRecord(FirmwareEndpointRecord, record, blob)) return false;
+        }
+        return true;
+    }
+
+    bool Configuration::appendRecord(const uint8_t tag, const std::vector<uint8_t>& data, std::vector<uint8_t>& blob) {
+        if (data.size() > UINT16_MAX) return false;
+        const auto length = static_cast<uint16_t>(data.size());
+        blob.push_back(tag);
+        blob.resize(blob.size() + sizeof length);
+        memcpy(&blob[blob.size() - sizeof length], &length, sizeof length);
+        blob.insert(blob.end(), data.begin(), data.end());
+        return true;
+    }
+
+    uint32_t Configuration::endpointHash(const char* source, const char* defaultScheme, const uint16_t defaultPort) {
+        // FNV-1a of everything the endpoint is derived from, to check that it still matches the section
+        uint32_t hash = 2166136261u;
+        const auto add = [&hash](const uint8_t value) { hash = (hash ^ value) * 16777619u; };
+        for (const auto text : { source, defaultScheme }) {
+            for (auto character = text; *character != 0; character++) add(static_cast<uint8_t>(*character));
+            add(0);
+        }
+        add(static_cast<uint8_t>(defaultPort));
+        add(static_cast<uint8_t>(defaultPort >> 8));
+        return hash;
+    }
+
+    bool Configuration::isEqual(const char* first, const char* second) {
+        if (first == nullptr || second == nullptr) return first == second;
+        return strcmp(first, second) == 0;
     }
 
-    char* Configuration::getWifiConfig(char* start) {
-        _preferences->begin(Wifi, true);
-        wifi.deviceName = storeToBuffer(DeviceName, &start);
-        wifi.ssid = storeToBuffer(Ssid, &start);
-        wifi.password = storeToBuffer(Password, &start);
-        if (_preferences->isKey(Bssid)) {
-            _preferences->getBytes(Bssid, start, 6);
-            wifi.bssid = reinterpret_cast<uint8_t*>(start);
-            start += 6;
+    bool Configuration::isEqual(const SectionDescriptor& section, const void* first, const void* second) {
+        const auto left = static_cast<const char*>(first);
+        const auto right = static_cast<const char*>(second);
+        for (uint8_t index = 0; index < section.fieldCount; index++) {
+            const auto& field = section.fields[index];
+            bool isSame = true;
+            switch (field.type) {
+            case FieldType::Address:
+                isSame = static_cast<uint32_t>(*reinterpret_cast<const IPAddress*>(left + field.offset)) == 
+                    static_cast<uint32_t>(*reinterpret_cast<const IPAddress*>(right + field.offset));
+                break;
+            case FieldType::UInt: {
+                // 0 means "not set", i.e. the default
+                auto leftValue = *reinterpret_cast<const unsigned int*>(left + field.offset);
+                auto rightValue = *reinterpret_cast<const unsigned int*>(right + field.offset);
+                if (leftValue == 0) leftValue = field.defaultValue;
+                if (rightValue == 0) rightValue = field.defaultValue;
+                isSame = leftValue == rightValue;
+                break;
+            }
+            case FieldType::Bool:
+                isSame = *reinterpret_cast<const bool*>(left + field.offset) == *reinterpret_cast<const bool*>(right + field.offset);
+                break;
+            case FieldType::String:
+            case FieldType::Certificate:
+                isSame = isEqual(*reinterpret_cast<const char* const*>(left + field.offset), *reinterpret_cast<const char* const*>(right + field.offset));
+                break;
+            case FieldType::Bssid: {
+                const auto leftValue = *reinterpret_cast<const uint8_t* const*>(left + field.offset);
+                const auto rightValue = *reinterpret_cast<const uint8_t* const*>(right + field.offset);
+                isSame = leftValue == nullptr || rightValue == nullptr ? leftValue == rightValue : memcmp(leftValue, rightValue, BssidSize) == 0;
+                break;
+            }
+            }
+            if (!isSame) return false;
+        }
+        return true;
+    }
+
+    void Configuration::bumpGeneration() const {
+        _preferences->putUInt(Generation, _preferences->getUInt(Generation, 0) + 1);
+    }
+
+    unsigned int Configuration::putBytesIfChanged(const char* key, const void* value, const size_t size) const {
+        if (value == nullptr) return removeIfExists(key);
+        if (_preferences->getBytesLength(key) == size) {
+            std::unique_ptr<uint8_t[]> stored(new uint8_t[size]);
+            if (_preferences->getBytes(key, stored.get(), size) == size && memcmp(stored.get(), value, size) == 0) return 0;
+        }
+        return countWrite(_preferences->putBytes(key, value, size) == size);
+    }
+
+    unsigned int Configuration::putBoolIfChanged(const char* key, const bool value) const {
+        if (_preferences->isKey(key) && _preferences->getBool(key) == value) return 0;
+        return countWrite(_preferences->putBool(key, value) > 0);
+    }
+
+    unsigned int Configuration::putCertificateIfChanged(const char* pemKey, const char* derKey, const char* pem, const CertificateFormat format) const {
+        // DER is stored as the label with terminator, followed by the DER object(s)
+        std::string label;
+        std::vector<uint8_t> der;
+        if (format == CertificateFormat::Der && pem != nullptr && Pem::toDer(pem, label, der)) {
+            der.insert(der.begin(), label.c_str(), label.c_str() + label.size() + 1);
+            return putBytesIfChanged(derKey, der.data(), der.size()) + removeIfExists(pemKey) + removeChunks(pemKey);
+        }
+        return putStringIfChanged(pemKey, pem) + removeIfExists(derKey) + removeChunks(pemKey);
+    }
+
+    unsigned int Configuration::putDhcpLease(const DhcpLease* lease) const {
+        waitForLoad();
+        const auto measurement = startMeasurement();
+        _preferences->begin(Ip, false);
+        unsigned int written;
+        if (lease == nullptr) {
+            written = removeIfExists(Lease);
         }
         else {
-            wifi.bssid = nullptr;
+            uint8_t blob[LeaseSize];
+            blob[0] = LeaseVersion;
+            const uint32_t addresses[IpCount] = { lease->ip.localIp, lease->ip.gateway, lease->ip.subnetMask, lease->ip.primaryDns, lease->ip.secondaryDns };
+            memcpy(blob + 1, addresses, sizeof addresses);
+            memcpy(blob + LeaseExpiryOffset, &lease->expiry, sizeof lease->expiry);
+            memcpy(blob + LeaseBssidOffset, lease->bssid, BssidSize);
+            written = putBytesIfChanged(Lease, blob, sizeof blob);
         }
         _preferences->end();
-        return start;
+        recordStore(_stats.section[static_cast<uint8_t>(Section::Ip)], measurement, written);
+        return written;
+    }
+
+    unsigned int Configuration::putEndpoint(const char* source, const char* defaultScheme, const uint16_t defaultPort) const {
+        // the namespace is open; the endpoint is derived, so it is not counted in the keys written
+        std::vector<uint8_t> blob;
+        if (source == nullptr || !packEndpoint(source, defaultScheme, defaultPort, blob)) return removeIfExists(EndpointParts);
+        std::vector<char> stored(_preferences->getBytesLength(EndpointParts));
+        Endpoint storedEndpoint{};
+        uint32_t storedHash = 0;
+        const bool hasStored = !stored.empty() && _preferences->getBytes(EndpointParts, stored.data(), stored.size()) == stored.size() &&
+            parseEndpoint(stored.data(), stored.size(), storedEndpoint, storedHash);
+        if (hasStored && storedHash == endpointHash(source, defaultScheme, defaultPort)) return 0;
+        if (hasStored) keepAddress(storedEndpoint, blob);
+        return countWrite(_preferences->putBytes(EndpointParts, blob.data(), blob.size()) == blob.size());
+    }
+
+    void Configuration::keepAddress(const Endpoint& known, std::vector<uint8_t>& blob) {
+        // the cached address still applies if the host and port did not change
+        Endpoint endpoint{};
+        uint32_t hash;
+        parseEndpoint(reinterpret_cast<char*>(blob.data()), blob.size(), endpoint, hash);
+        if (known.host == nullptr || strcmp(known.host, endpoint.host) != 0 || known.port != endpoint.port) return;
+        const auto address = static_cast<uint32_t>(known.address);
+        memcpy(&blob[EndpointAddressOffset], &address, sizeof address);
+        memcpy(&blob[EndpointExpiryOffset], &known.addressExpiry, sizeof known.addressExpiry);
+    }
+
+    void Configuration::putEndpointOf(const Section section, const void* data) const {
+        // the namespace is open
+        if (section == Section::Mqtt) {
+            const auto mqttConfig = static_cast<const MqttConfig*>(data);
+            putEndpoint(mqttConfig->broker, mqttConfig->useTls ? MqttTlsScheme : MqttScheme, mqttPort(*mqttConfig));
+        }
+        else if (section == Section::Firmware) {
+            putEndpoint(static_cast<const FirmwareConfig*>(data)->baseUrl, FirmwareScheme, 0);
+        }
+    }
+
+    unsigned int Configuration::putField(const SectionDescriptor& section, const uint8_t index, const void* data, const CertificateFormat format) const {
+        // the namespace is open
+        const auto& field = section.fields[index];
+        const auto member = static_cast<const char*>(data) + field.offset;
+        switch (effectiveType(section, field)) {
+        case FieldType::Address:
+            return putUIntIfChanged(field.key, *reinterpret_cast<const IPAddress*>(member));
+        case FieldType::UInt: {
+            // 0 means "not set", i.e. the default
+            const auto value = *reinterpret_cast<const unsigned int*>(member);
+            return value == 0 ? removeIfExists(field.key) : putUIntIfChanged(field.key, value);
+        }
+        case FieldType::Bool:
+            return putBoolIfChanged(field.key, *reinterpret_cast<const bool*>(member));
+        case FieldType::String:
+            return putStringIfChanged(field.key, *reinterpret_cast<const char* const*>(member));
+        case FieldType::Bssid:
+            return putBytesIfChanged(field.key, *reinterpret_cast<const uint8_t* const*>(member), BssidSize);
+        case FieldType::Certificate:
+            return putCertificateIfChanged(field.key, CertificateDerKeys[index], *reinterpret_cast<const char* const*>(member), format);
+        }
+        return 0;
+    }
+
+    unsigned int Configuration::putFields(const SectionDescriptor& section, const void* data, const CertificateFormat format) const {
+        // the namespace is open
+        unsigned int written = 0;
+        for (uint8_t index = 0; index < section.fieldCount; index++) written += putField(section, index, data, format);
+        return written;
+    }
+
+    unsigned int Configuration::putFirmwareConfig(const FirmwareConfig* firmwareConfig) const {
+        waitForLoad();
+        if (firmwareConfig == nullptr) return 0;
+        if (_storageMode == StorageMode::Packed) {
+            return putPacked(nullptr, nullptr, nullptr, nullptr, firmwareConfig);
+        }
+        return putSectionPerKey(Section::Firmware, firmwareConfig);
     }
 
-    void Configuration::putFirmwareConfig(const FirmwareConfig* firmwareConfig) const {
-        if (firmwareConfig == nullptr) return;
-        _preferences->begin(Firmware, false);
-        _preferences->putString(Url, firmwareConfig->baseUrl);
+    unsigned int Configuration::putIpConfig(const IpConfig* ipConfig) const {
+        waitForLoad();
+        if (ipConfig == nullptr) return 0;
+        if (_storageMode == StorageMode::Packed) {
+            return putPacked(ipConfig, nullptr, nullptr, nullptr, nullptr);
+        }
+        return putSectionPerKey(Section::Ip, ipConfig);
+    }
+
+    unsigned int Configuration::putMqttConfig(const MqttConfig* mqttConfig) const {
+        waitForLoad();
+        if (mqttConfig == nullptr) return 0;
+        if (_storageMode == StorageMode::Packed) {
+            return putPacked(nullptr, nullptr, nullptr, mqttConfig, nullptr);
+        }
+        return putSectionPerKey(Section::Mqtt, mqttConfig);
+    }
+
+    unsigned int Configuration::putPacked(const IpConfig* ipConfig, const WifiConfig* wifiConfig, const TlsConfig* tlsConfig, 
+                                          const MqttConfig* mqttConfig, const FirmwareConfig* firmwareConfig, const uint8_t field) const {
+        // Start from what is stored now, so the sections that are not being put are kept.
+        // If there is no blob yet, that is the per-key layout, which gets migrated.
+        const auto measurement = startMeasurement();
+        const auto currentSize = requiredBufferSize(_preferences.preferences, StorageMode::Packed);
+        std::unique_ptr<char[]> currentBuffer(new char[currentSize]);
+        std::unique_ptr<Configuration> current(new Configuration(_preferences.preferences, currentBuffer.get(), currentSize));
+        const bool isMigration = !current->loadPacked();
+        if (isMigration) {
+            // the sections that were not put come from the image, if any
+            current->_image = _image;
+            current->begin();
+            // the blob holds PEM, so convert what was stored as DER
+            current->rebuildPem();
+        }
+        // overlay the sections (or the field) that changed, and bump their generations
+        bool isChanged = false;
+        const void* changes[] = { ipConfig, wifiConfig, tlsConfig, mqttConfig, firmwareConfig };
+        for (uint8_t index = 0; index < SectionCount; index++) {
+            const auto section = static_cast<Section>(index);
+            auto changed = BuiltInSections[index];
+            if (field != AllFields) changed = { changed.name, changed.fields + field, 1 };
+            if (changes[index] == nullptr || isEqual(changed, changes[index], current->sectionData(section))) continue;
+            current->copyFields(changed, changes[index], current->sectionData(section), false);
+            current->_sectionGeneration[index]++;
+            isChanged = true;
+        }
+
+        // the reads done for the current configuration are part of the cost
+        _preferences.operations += current->_preferences.operations;
+
+        // the endpoint records follow the sections they are derived from, so they need no separate write
+        std::vector<uint8_t> blob;
+        unsigned int written = 0;
+        if (isChanged || isMigration) written = current->pack(blob, true) ? writePacked(blob, current->_generation + 1) : WriteFailed;
+        if (isMigration && written == 1) {
+            // the blob holds the profiles and the endpoints now; only the lease stays in its namespace
+            for (uint8_t section = 0; section < SectionCount; section++) {
+                _preferences->begin(SectionNamespaces[section], false);
+                if (static_cast<Section>(section) == Section::Ip) {
+                    clearSection(Section::Ip);
+                }
+                else {
+                    _preferences->clear();
+                }
+                _preferences->end();
+            }
+        }
+        recordStore(_stats.packed, measurement, written);
+        return written;
+    }
+
+    bool Configuration::putPackedRecords(const std::function<void(Configuration&)>& update, SectionStats& stats, unsigned int& written) const {
+        // The records are not part of a section, so the section generations stay. Returns false if there is no blob yet;
+        // then the profiles and endpoints are still in their namespaces.
+        const auto measurement = startMeasurement();
+        const auto currentSize = requiredBufferSize(_preferences.preferences, StorageMode::Packed);
+        std::unique_ptr<char[]> currentBuffer(new char[currentSize]);
+        std::unique_ptr<Configuration> current(new Configuration(_preferences.preferences, currentBuffer.get(), currentSize));
+        const bool hasBlob = current->loadPacked();
+        _preferences.operations += current->_preferences.operations;
+        if (!hasBlob) return false;
+        update(*current);
+        // stored best first, so loading them again does not reorder them
+        sortProfiles(current->wifiProfiles, current->wifiProfileCount);
+        std::vector<uint8_t> blob;
+        if (!current->pack(blob, true)) {
+            written = WriteFailed;
+        }
+        else if (blob.size() == currentSize && memcmp(blob.data(), currentBuffer.get(), currentSize) == 0) {
+            written = 0;
+        }
+        else {
+            written = writePacked(blob, current->_generation + 1);
+        }
+        recordStore(stats, measurement, written);
+        return true;
+    }
+
+    unsigned int Configuration::writePacked(std::vector<uint8_t>& blob, const uint32_t generation) const {
+        memcpy(&blob[GenerationOffset], &generation, sizeof generation);
+        _preferences->begin(Config, false);
+        const auto written = _preferences->putBytes(Packed, blob.data(), blob.size()) == blob.size() ? 1 : WriteFailed;
         _preferences->end();
+        return written;
     }
 
-    void Configuration::putIpConfig(const IpConfig* ipConfig) const {
-        if (ipConfig == nullptr) return;
-        _preferences->begin(Ip, false);
-        _preferences->clear();
-        _preferences->putUInt(Local, ipConfig->localIp);
-        _preferences->putUInt(Gateway, ipConfig->gateway);
-        _preferences->putUInt(SubnetMask, ipConfig->subnetMask);
-        _preferences->putUInt(Dns1, ipConfig->primaryDns);
-        _preferences->putUInt(Dns2, ipConfig->secondaryDns);
+    bool Configuration::packEndpoint(const char* source, const char* defaultScheme, const uint16_t defaultPort, std::vector<uint8_t>& blob) {
+        // [scheme://][user@]host[:port][path], where host can be an IPv6 address in brackets
+        auto scheme = defaultScheme;
+        auto schemeLength = strlen(defaultScheme);
+        auto authority = source;
+        const auto separator = strstr(source, "://");
+        if (separator != nullptr) {
+            scheme = source;
+            schemeLength = static_cast<size_t>(separator - source);
+            authority = separator + 3;
+        }
+        const auto path = authority + strcspn(authority, "/?#");
+        for (auto character = authority; character < path; character++) {
+            if (*character == '@') authority = character + 1;
+        }
+        auto host = authority;
+        auto hostEnd = path;
+        auto portSeparatorStart = host;
+        if (*host == '[') {
+            const auto closing = static_cast<const char*>(memchr(host, ']', static_cast<size_t>(path - host)));
+            if (closing == nullptr) return false;
+            host++;
+            hostEnd = closing;
+            portSeparatorStart = closing;
+        }
+        const auto colon = static_cast<const char*>(memchr(portSeparatorStart, ':', static_cast<size_t>(path - portSeparatorStart)));
+        if (colon != nullptr && colon < hostEnd) hostEnd = colon;
+        if (hostEnd == host) return false;
+
+        uint32_t port = 0;
+        if (colon != nullptr) {
+            for (auto digit = colon + 1; digit < path && port <= UINT16_MAX; digit++) {
+                if (*digit < '0' || *digit > '9') return false;
+                port = port * 10 + static_cast<uint32_t>(*digit - '0');
+            }
+            if (port > UINT16_MAX) return false;
+        }
+        if (port == 0) port = defaultPort;
+        for (const auto& schemePort : SchemePorts) {
+            if (port == 0 && strlen(schemePort.scheme) == schemeLength && strncmp(schemePort.scheme, scheme, schemeLength) == 0) {
+                port = schemePort.port;
+            }
+        }
+
+        blob.assign(EndpointStringsOffset, 0);
+        blob[0] = EndpointVersion;
+        const auto hash = endpointHash(source, defaultScheme, defaultPort);
+        memcpy(&blob[EndpointHashOffset], &hash, sizeof hash);
+        const auto port16 = static_cast<uint16_t>(port);
+        memcpy(&blob[EndpointPortOffset], &port16, sizeof port16);
+        const auto append = [&blob](const char* start, const size_t length) {
+            blob.insert(blob.end(), start, start + length);
+            blob.push_back(0);
+        };
+        append(scheme, schemeLength);
+        append(host, static_cast<size_t>(hostEnd - host));
+        append(path, strlen(path));
+        return true;
+    }
+
+    void Configuration::packProfiles(const WifiProfile* profiles, const uint8_t count, std::vector<uint8_t>& blob) {
+        blob.assign(ProfilesHeaderSize, 0);
+        blob[0] = ProfilesVersion;
+        blob[1] = count;
+        for (uint8_t index = 0; index < count; index++) {
+            const auto& profile = profiles[index];
+            const auto offset = blob.size();
+            blob.resize(offset + ProfileFixedSize, 0);
+            blob[offset] = profile.bssid != nullptr ? ProfileHasBssidFlag : 0;
+            blob[offset + ProfileChannelOffset] = profile.channel;
+            memcpy(&blob[offset + ProfileSuccessesOffset], &profile.successes, sizeof profile.successes);
+            memcpy(&blob[offset + ProfileFailuresOffset], &profile.failures, sizeof profile.failures);
+            memcpy(&blob[offset + ProfileLastSuccessOffset], &profile.lastSuccess, sizeof profile.lastSuccess);
+            if (profile.bssid != nullptr) {
+                memcpy(&blob[offset + ProfileBssidOffset], profile.bssid, BssidSize);
+            }
+            for (const auto value : { profile.ssid, profile.password }) {
+                const auto length = value == nullptr ? 0 : strlen(value) + 1;
+                blob.push_back(static_cast<uint8_t>(length));
+                blob.insert(blob.end(), value, value + length);
+            }
+        }
+    }
+
+    bool Configuration::parseEndpoint(char* blob, const size_t size, Endpoint& endpoint, uint32_t& sourceHash) {
+        if (size < EndpointStringsOffset || blob[0] != EndpointVersion) return false;
+        memcpy(&sourceHash, blob + EndpointHashOffset, sizeof sourceHash);
+        memcpy(&endpoint.port, blob + EndpointPortOffset, sizeof endpoint.port);
+        uint32_t address;
+        memcpy(&address, blob + EndpointAddressOffset, sizeof address);
+        endpoint.address = address;
+        memcpy(&endpoint.addressExpiry, blob + EndpointExpiryOffset, sizeof endpoint.addressExpiry);
+        auto offset = EndpointStringsOffset;
+        for (const auto field : { &endpoint.scheme, &endpoint.host, &endpoint.path }) {
+            const auto terminator = static_cast<char*>(memchr(blob + offset, 0, size - offset));
+            if (terminator == nullptr) return false;
+            *field = blob + offset;
+            offset = static_cast<size_t>(terminator - blob) + 1;
+        }
+        return true;
+    }
+
+    uint8_t Configuration::parseProfiles(char* blob, const size_t size, WifiProfile* profiles) {
+        if (size < ProfilesHeaderSize || blob[0] != ProfilesVersion) return 0;
+        const auto count = std::min(static_cast<uint8_t>(blob[1]), MaxWifiProfiles);
+        auto offset = ProfilesHeaderSize;
+        for (uint8_t index = 0; index < count; index++) {
+            if (offset + ProfileFixedSize > size) return 0;
+            auto& profile = profiles[index];
+            const auto flags = static_cast<uint8_t>(blob[offset]);
+            profile.channel = static_cast<uint8_t>(blob[offset + ProfileChannelOffset]);
+            memcpy(&profile.successes, blob + offset + ProfileSuccessesOffset, sizeof profile.successes);
+            memcpy(&profile.failures, blob + offset + ProfileFailuresOffset, sizeof profile.failures);
+            memcpy(&profile.lastSuccess, blob + offset + ProfileLastSuccessOffset, sizeof profile.lastSuccess);
+            profile.bssid = (flags & ProfileHasBssidFlag) != 0 ? reinterpret_cast<const uint8_t*>(blob + offset + ProfileBssidOffset) : nullptr;
+            offset += ProfileFixedSize;
+            for (const auto field : { &profile.ssid, &profile.password }) {
+                if (offset >= size) return 0;
+                const auto length = static_cast<uint8_t>(blob[offset++]);
+                if (length == 0) {
+                    *field = nullptr;
+                    continue;
+                }
+                if (offset + length > size || blob[offset + length - 1] != 0) return 0;
+                *field = blob + offset;
+                offset += length;
+            }
+            if (profile.ssid == nullptr) return 0;
+        }
+        return count;
+    }
+
+    unsigned int Configuration::putProfiles(const WifiProfile* profiles, const uint8_t count) const {
+        if (count == 0) return removeIfExists(Profiles);
+        std::vector<uint8_t> blob;
+        packProfiles(profiles, count, blob);
+        return putBytesIfChanged(Profiles, blob.data(), blob.size());
+    }
+
+    unsigned int Configuration::putWifiProfiles(const WifiProfile* profiles, uint8_t count) const {
+        waitForLoad();
+        if (profiles == nullptr) count = 0;
+        count = std::min(count, MaxWifiProfiles);
+        for (uint8_t index = 0; index < count; index++) {
+            const auto& profile = profiles[index];
+            if (profile.ssid == nullptr || strlen(profile.ssid) >= MaxProfileStringSize) return 0;
+            if (profile.password != nullptr && strlen(profile.password) >= MaxProfileStringSize) return 0;
+        }
+        auto& stats = _stats.section[static_cast<uint8_t>(Section::Wifi)];
+        unsigned int written;
+        if (_storageMode == StorageMode::Packed && putPackedRecords([profiles, count](Configuration& current) {
+                WifiProfile merged[MaxWifiProfiles];
+                mergeProfiles(profiles, count, current.wifiProfiles, current.wifiProfileCount, merged);
+                std::copy(merged, merged + count, current.wifiProfiles);
+                current.wifiProfileCount = count;
+            }, stats, written)) {
+            return written;
+        }
+        const auto measurement = startMeasurement();
+        _preferences->begin(Wifi, false);
+        std::vector<char> storedBlob;
+        WifiProfile stored[MaxWifiProfiles];
+        const auto storedCount = readProfiles(storedBlob, stored);
+        WifiProfile merged[MaxWifiProfiles];
+        mergeProfiles(profiles, count, stored, storedCount, merged);
+        written = putProfiles(merged, count);
         _preferences->end();
+        recordStore(stats, measurement, written);
+        return written;
     }
 
-    void Configuration::putMqttConfig(const MqttConfig* mqttConfig) const {
-        if (mqttConfig == nullptr) return;
-        _preferences->begin(Mqtt, false);
-        _preferences->clear();
-        putStringIfNotNull(Broker, mqttConfig->broker);
-        if (mqttConfig->port != 0) {
-            _preferences->putUInt(Port, mqttConfig->port);
+    void Configuration::mergeProfiles(const WifiProfile* profiles, const uint8_t count, const WifiProfile* stored, const uint8_t storedCount,
+                                      WifiProfile* merged) {
+        // profiles with an SSID that is known already keep what was learned about them
+        for (uint8_t index = 0; index < count; index++) {
+            merged[index] = profiles[index];
+            for (uint8_t storedIndex = 0; storedIndex < storedCount; storedIndex++) {
+                const auto& known = stored[storedIndex];
+                if (!isEqual(known.ssid, merged[index].ssid)) continue;
+                merged[index].bssid = known.bssid;
+                merged[index].channel = known.channel;
+                merged[index].successes = known.successes;
+                merged[index].failures = known.failures;
+                merged[index].lastSuccess = known.lastSuccess;
+            }
         }
-        putStringIfNotNull(User, mqttConfig->user);
-        putStringIfNotNull(Password, mqttConfig->password);
-        _preferences->putBool(UseTls, mqttConfig->useTls);
+    }
+
+    IpConfig Configuration::provisionalIpConfig(const uint32_t now, const uint8_t* bssid) {
+        waitForLoad();
+        const auto& configured = ipConfig();
+        if (static_cast<uint32_t>(configured.localIp) != 0) return configured;
+        if (bssid == nullptr) return IpAutoConfig;
+        uint8_t blob[LeaseSize];
+        _preferences->begin(Ip, true);
+        const auto size = _preferences->isKey(Lease) ? _preferences->getBytes(Lease, blob, sizeof blob) : 0;
         _preferences->end();
+        if (size != LeaseSize || blob[0] != LeaseVersion) return IpAutoConfig;
+        uint32_t expiry;
+        memcpy(&expiry, blob + LeaseExpiryOffset, sizeof expiry);
+        if (now >= expiry || memcmp(blob + LeaseBssidOffset, bssid, BssidSize) != 0) return IpAutoConfig;
+        uint32_t addresses[IpCount];
+        memcpy(addresses, blob + 1, sizeof addresses);
+        return { addresses[0], addresses[1], addresses[2], addresses[3], addresses[4] };
     }
 
-    void Configuration::putStringIfNotNull(const char* key, const char* value) const {
-        if (value != nullptr) {
-            _preferences->putString(key, value);
+    unsigned int Configuration::putResolvedAddress(const Section section, const IPAddress& address, const uint32_t expiry) const {
+        waitForLoad();
+        if (section != Section::Mqtt && section != Section::Firmware) return 0;
+        const auto index = static_cast<uint8_t>(section);
+        unsigned int written = 0;
+        if (_storageMode == StorageMode::Packed && putPackedRecords([section, &address, expiry](Configuration& current) {
+                auto& endpoint = section == Section::Mqtt ? current.mqttEndpoint : current.firmwareEndpoint;
+                if (endpoint.host == nullptr) return;
+                endpoint.address = address;
+                endpoint.addressExpiry = expiry;
+            }, _stats.section[index], written)) {
+            return written;
+        }
+        const auto measurement = startMeasurement();
+        _preferences->begin(SectionNamespaces[index], false);
+        std::vector<uint8_t> blob(_preferences->getBytesLength(EndpointParts));
+        auto hasEndpoint = blob.size() >= EndpointStringsOffset &&
+            _preferences->getBytes(EndpointParts, blob.data(), blob.size()) == blob.size() && blob[0] == EndpointVersion;
+        if (!hasEndpoint && _image != nullptr && !_preferences->isKey(Generation)) {
+            // a section that is still in the image has no endpoint record yet, so make it from the image (without copying)
+            Configuration imageView(_preferences.preferences, nullptr, 0);
+            if (imageView.parsePacked(_image->data(), _image->size(), static_cast<uint8_t>(1 << index)) != 0) {
+                const auto& mqttConfig = imageView.mqtt;
+                hasEndpoint = section == Section::Mqtt
+                    ? mqttConfig.broker != nullptr && packEndpoint(mqttConfig.broker, mqttConfig.useTls ? MqttTlsScheme : MqttScheme, mqttPort(mqttConfig), blob)
+                    : imageView.firmware.baseUrl != nullptr && packEndpoint(imageView.firmware.baseUrl, FirmwareScheme, 0, blob);
+            }
         }
+        if (hasEndpoint) {
+            const auto value = static_cast<uint32_t>(address);
+            memcpy(&blob[EndpointAddressOffset], &value, sizeof value);
+            memcpy(&blob[EndpointExpiryOffset], &expiry, sizeof expiry);
+            written = putBytesIfChanged(EndpointParts, blob.data(), blob.size());
+        }
+        _preferences->end();
+        recordStore(_stats.section[index], measurement, written);
+        return written;
     }
 
-    void Configuration::putTlsConfig(const TlsConfig* tlsConfig) const {
-        if (tlsConfig == nullptr) return;
-        _preferences->begin(Tls, false);
-        _preferences->clear();
-        putStringIfNotNull(RootCaCert, tlsConfig->rootCaCertificate);
-        putStringIfNotNull(DeviceCert, tlsConfig->deviceCertificate);
-        putStringIfNotNull(DeviceKey, tlsConfig->devicePrivateKey);
+    unsigned int Configuration::putSection(const SectionDescriptor* section, const void* data) const {
+        waitForLoad();
+        if (section == nullptr || data == nullptr) return 0;
+        _preferences->begin(section->name, false);
+        const auto written = putFields(*section, data, CertificateFormat::Pem);
+        if (written > 0) bumpGeneration();
         _preferences->end();
+        return written;
     }
 
-    void Configuration::putWifiConfig(const WifiConfig* wifiConfig) const {
-        if (wifiConfig == nullptr) return;
-        _preferences->begin(Wifi, false);
-        _preferences->clear();
-        putStringIfNotNull(DeviceName, wifiConfig->deviceName);
-        putStringIfNotNull(Ssid, wifiConfig->ssid);
-        putStringIfNotNull(Password, wifiConfig->password);
-        if (wifiConfig->bssid != nullptr) {
-            _preferences->putBytes(Bssid, wifiConfig->bssid, 6);
+    unsigned int Configuration::putSectionPerKey(const Section section, const void* data, const CertificateFormat format, const uint8_t field) const {
+        const auto index = static_cast<uint8_t>(section);
+        const auto measurement = startMeasurement();
+        _preferences->begin(SectionNamespaces[index], false);
+        // over an image, the generation also marks the section as put when all its values are empty. 
+        // Then the whole section is written, as it is no longer loaded from the image.
+        const bool isOverImage = _image != nullptr && !_preferences->isKey(Generation);
+        const auto written = field == AllFields || isOverImage ? 
+            putFields(BuiltInSections[index], data, format) : putField(BuiltInSections[index], field, data, format);
+        putEndpointOf(section, data);
+        if (written > 0 || isOverImage) bumpGeneration();
+        _preferences->end();
+        recordStore(_stats.section[index], measurement, written);
+        return written;
+    }
+
+    unsigned int Configuration::putStringIfChanged(const char* key, const char* value) const {
+        if (value == nullptr) return removeIfExists(key);
+        // getString only copies if the stored value (with terminator) fits, so a different length returns 0 too.
+        const auto size = strlen(value) + 1;
+        std::unique_ptr<char[]> stored(new char[size]);
+        if (_preferences->getString(key, stored.get(), size) == size && memcmp(stored.get(), value, size) == 0) return 0;
+        return countWrite(_preferences->putString(key, value) > 0);
+    }
+
+    unsigned int Configuration::putTlsConfig(const TlsConfig* tlsConfig, const CertificateFormat format) const {
+        waitForLoad();
+        if (tlsConfig == nullptr) return 0;
+        if (_storageMode == StorageMode::Packed) {
+            return putPacked(nullptr, nullptr, tlsConfig, nullptr, nullptr);
         }
+        return putSectionPerKey(Section::Tls, tlsConfig, format);
+    }
+
+    unsigned int Configuration::putUIntIfChanged(const char* key, const uint32_t value) const {
+        if (_preferences->isKey(key) && _preferences->getUInt(key) == value) return 0;
+        return countWrite(_preferences->putUInt(key, value) > 0);
+    }
+
+    unsigned int Configuration::putWifiConfig(const WifiConfig* wifiConfig) const {
+        waitForLoad();
+        if (wifiConfig == nullptr) return 0;
+        if (_storageMode == StorageMode::Packed) {
+            return putPacked(nullptr, wifiConfig, nullptr, nullptr, nullptr);
+        }
+        return putSectionPerKey(Section::Wifi, wifiConfig);
+    }
+
+    uint8_t Configuration::readProfiles(std::vector<char>& blob, WifiProfile* profiles) const {
+        blob.resize(_preferences->getBytesLength(Profiles));
+        if (blob.empty() || _preferences->getBytes(Profiles, blob.data(), blob.size()) != blob.size()) return 0;
+        return parseProfiles(blob.data(), blob.size(), profiles);
+    }
+
+    unsigned int Configuration::recordWifiResult(const char* ssid, const bool isConnected, const uint8_t* bssid, const uint8_t channel) const {
+        waitForLoad();
+        auto& stats = _stats.section[static_cast<uint8_t>(Section::Wifi)];
+        unsigned int written = 0;
+        if (_storageMode == StorageMode::Packed && putPackedRecords([=](Configuration& current) {
+                applyWifiResult(current.wifiProfiles, current.wifiProfileCount, ssid, isConnected, bssid, channel);
+            }, stats, written)) {
+            return written;
+        }
+        const auto measurement = startMeasurement();
+        _preferences->begin(Wifi, false);
+        std::vector<char> blob;
+        WifiProfile profiles[MaxWifiProfiles];
+        const auto count = readProfiles(blob, profiles);
+        if (applyWifiResult(profiles, count, ssid, isConnected, bssid, channel)) written = putProfiles(profiles, count);
         _preferences->end();
+        recordStore(stats, measurement, written);
+        return written;
+    }
+
+    bool Configuration::applyWifiResult(WifiProfile* profiles, const uint8_t count, const char* ssid, const bool isConnected, 
+                                        const uint8_t* bssid, const uint8_t channel) {
+        // returns false if the SSID is not one of the profiles
+        for (uint8_t index = 0; index < count; index++) {
+            auto& profile = profiles[index];
+            if (!isEqual(profile.ssid, ssid)) continue;
+            if (isConnected) {
+                uint32_t mostRecent = 0;
+                for (uint8_t other = 0; other < count; other++) mostRecent = std::max(mostRecent, profiles[other].lastSuccess);
+                if (profile.lastSuccess == 0 || profile.lastSuccess != mostRecent) profile.lastSuccess = mostRecent + 1;
+                if (profile.successes < UINT16_MAX) profile.successes++;
+                profile.failures = 0;
+                profile.bssid = bssid;
+                profile.channel = bssid == nullptr ? 0 : channel;
+            }
+            else if (profile.failures < UINT16_MAX) {
+                profile.failures++;
+            }
+            return true;
+        }
+        return false;
+    }
+
+    unsigned int Configuration::removeChunks(const char* key) const {
+        char chunkKey[MaxKeyLength + 1];
+        unsigned int removed = 0;
+        while (true) {
+            toChunkKey(key, removed, chunkKey);
+            if (removeIfExists(chunkKey) == 0) return removed;
+            removed++;
+        }
+    }
+
+    unsigned int Configuration::removeIfExists(const char* key) const {
+        return _preferences->isKey(key) && _preferences->remove(key) ? 1 : 0;
+    }
+
+    const char* Configuration::pemToBuffer(const DerObject& der) {
+        if (der.data == nullptr) return nullptr;
+        const auto space = static_cast<size_t>(_buffer + _bufferSize - _next);
+        const auto length = Pem::toPem(der.label, der.data, der.length, _next, space);
+        if (length == 0) return nullptr;
+        const auto pem = _next;
+        _next += length;
+        return pem;
+    }
+
+    bool Configuration::rebuildPem() {
+        if (tls.rootCaCertificate == nullptr) tls.rootCaCertificate = pemToBuffer(tlsDer.rootCaCertificate);
+        if (tls.deviceCertificate == nullptr) tls.deviceCertificate = pemToBuffer(tlsDer.deviceCertificate);
+        if (tls.devicePrivateKey == nullptr) tls.devicePrivateKey = pemToBuffer(tlsDer.devicePrivateKey);
+        return (tls.rootCaCertificate != nullptr || tlsDer.rootCaCertificate.data == nullptr) &&
+            (tls.deviceCertificate != nullptr || tlsDer.deviceCertificate.data == nullptr) &&
+            (tls.devicePrivateKey != nullptr || tlsDer.devicePrivateKey.data == nullptr);
+    }
+
+    void Configuration::sortProfiles(WifiProfile* profiles, const uint8_t count) {
+        // stable insertion sort, so profiles that compare equal stay in the order they were put
+        const auto isBefore = [](const WifiProfile& first, const WifiProfile& second) {
+            const bool isFirstFailing = first.failures >= WifiFailureLimit;
+            const bool isSecondFailing = second.failures >= WifiFailureLimit;
+            if (isFirstFailing != isSecondFailing) return isSecondFailing;
+            return first.lastSuccess > second.lastSuccess;
+        };
+        for (uint8_t index = 1; index < count; index++) {
+            const auto profile = profiles[index];
+            auto position = index;
+            while (position > 0 && isBefore(profile, profiles[position - 1])) {
+                profiles[position] = profiles[position - 1];
+                position--;
+            }
+            profiles[position] = profile;
+        }
+    }
+
+    char* Configuration::storeBytesToBuffer(const char* key, const size_t size, char** startLocation) {
+        if (!_preferences->isKey(key)) return nullptr;
+        if (_isDryRun) {
+            _requiredSize += size;
+            return nullptr;
+        }
+        const auto start = *startLocation;
+        if (start + size > _buffer + _bufferSize || _preferences->getBytes(key, start, size) != size) {
+            _isTruncated = true;
+            return nullptr;
+        }
+        *startLocation += size;
+        return start;
+    }
+
+    const char* Configuration::storeCertificateToBuffer(const char* pemKey, const char* derKey, DerObject& der, char** startLocation) {
+        // a certificate is stored as PEM, as imported PEM chunks, or as DER; each form costs one lookup if absent
+        der = {};
+        const char* pem = storeToBuffer(pemKey, startLocation);
+        if (pem == nullptr) pem = storeChunksToBuffer(pemKey, startLocation);
+        if (pem == nullptr) der = storeDerToBuffer(derKey, startLocation);
+        return pem;
+    }
+
+    char* Configuration::storeChunksToBuffer(const char* key, char** startLocation) {
+        // The chunks are joined by overwriting the terminator of each chunk with the next one.
+        char chunkKey[MaxKeyLength + 1];
+        const auto start = *startLocation;
+        auto next = start;
+        unsigned int index = 0;
+        for (;; index++) {
+            toChunkKey(key, index, chunkKey);
+            if (!_preferences->isKey(chunkKey)) break;
+            if (_isDryRun) {
+                _requiredSize += _preferences->getString(chunkKey).length();
+                continue;
+            }
+            const auto space = static_cast<size_t>(_buffer + _bufferSize - next);
+            const auto length = _preferences->getString(chunkKey, next, space);
+            if (length == 0) {
+                _isTruncated = true;
+                return nullptr;
+            }
+            next += length - 1;
+        }
+        if (index == 0) return nullptr;
+        if (_isDryRun) {
+            _requiredSize++;
+            return nullptr;
+        }
+        *startLocation = next + 1;
+        return start;
+    }
+
+    DerObject Configuration::storeDerToBuffer(const char* key, char** startLocation) {
+        if (!_preferences->isKey(key)) return {};
+        const auto size = _preferences->getBytesLength(key);
+        if (size == 0) return {};
+        if (_isDryRun) {
+            // Sizing only: the DER value, and the PEM text that tlsConfig() can rebuild from it
+            std::unique_ptr<uint8_t[]> value(new uint8_t[size]);
+            _preferences->getBytes(key, value.get(), size);
+            const auto label = reinterpret_cast<const char*>(value.get());
+            const auto labelSize = strnlen(label, size) + 1;
+            _requiredSize += size;
+            if (labelSize < size) {
+                _requiredSize += Pem::pemLength(label, value.get() + labelSize, size - labelSize);
+            }
+            return {};
+        }
+        const auto start = *startLocation;
+        if (size > static_cast<size_t>(_buffer + _bufferSize - start) || _preferences->getBytes(key, start, size) != size) {
+            _isTruncated = true;
+            return {};
+        }
+        const auto labelSize = strnlen(start, size) + 1;
+        if (labelSize >= size) return {};
+        *startLocation += size;
+        return { start, reinterpret_cast<const uint8_t*>(start + labelSize), size - labelSize };
+    }
+
+    char* Configuration::storeEndpointToBuffer(const char* source, const char* defaultScheme, const uint16_t defaultPort, Endpoint& endpoint, char* start) {
+        endpoint = {};
+        const auto size = _preferences->getBytesLength(EndpointParts);
+        if (size == 0) return start;
+        if (_isDryRun) {
+            _requiredSize += size;
+            return start;
+        }
+        if (size > static_cast<size_t>(_buffer + _bufferSize - start) || _preferences->getBytes(EndpointParts, start, size) != size) {
+            _isTruncated = true;
+            return start;
+        }
+        return useEndpoint(start, size, source, defaultScheme, defaultPort, endpoint) ? start + size : start;
+    }
+
+    bool Configuration::useEndpoint(char* blob, const size_t size, const char* source, const char* defaultScheme, const uint16_t defaultPort, 
+                                    Endpoint& endpoint) {
+        // an endpoint that does not match the section (e.g. written by an older version) is not used
+        uint32_t hash;
+        if (source != nullptr && parseEndpoint(blob, size, endpoint, hash) && hash == endpointHash(source, defaultScheme, defaultPort)) return true;
+        endpoint = {};
+        return false;
+    }
+
+    char* Configuration::storeExtrasToBuffer(const Section section, char* start) {
+        // the namespace is open
+        switch (section) {
+        case Section::Wifi:
+            return storeProfilesToBuffer(start);
+        case Section::Mqtt:
+            return storeEndpointToBuffer(mqtt.broker, mqtt.useTls ? MqttTlsScheme : MqttScheme, mqttPort(mqtt), mqttEndpoint, start);
+        case Section::Firmware:
+            return storeEndpointToBuffer(firmware.baseUrl, FirmwareScheme, 0, firmwareEndpoint, start);
+        default:
+            return start;
+        }
+    }
+
+    char* Configuration::storeProfilesToBuffer(char* start) {
+        wifiProfileCount = 0;
+        const auto size = _preferences->getBytesLength(Profiles);
+        if (size == 0) return start;
+        if (_isDryRun) {
+            _requiredSize += size;
+            return start;
+        }
+        if (size > static_cast<size_t>(_buffer + _bufferSize - start) || _preferences->getBytes(Profiles, start, size) != size) {
+            _isTruncated = true;
+            return start;
+        }
+        wifiProfileCount = parseProfiles(start, size, wifiProfiles);
+        sortProfiles(wifiProfiles, wifiProfileCount);
+        return start + size;
     }
 
     char* Configuration::storeToBuffer(const char* key, char** startLocation) {
-        if (_preferences->isKey(key)) {
-            SafeCString::pointerStrcpy(*startLocation, _buffer, _preferences->getString(key).c_str());
-            const auto returnValue = *startLocation;
-            *startLocation += strlen(*startLocation) + 1;
-            return returnValue;
+        // Read straight into the buffer, which avoids the heap allocation of getString(key).
+        // Check the key first: getString logs an error for a missing key on the ESP32.
+        if (!_preferences->isKey(key)) return nullptr;
+        if (_isDryRun) {
+            // Sizing only. Unlike the real load, this needs a heap allocation as there is nothing to read into.
+            _requiredSize += _preferences->getString(key).length() + 1;
+            return nullptr;
+        }
+        // This gets the stored length first and returns 0 without copying if the value (with terminator)
+        // does not fit the remaining space.
+        const auto returnValue = *startLocation;
+        const auto space = static_cast<size_t>(_buffer + _bufferSize - returnValue);
+        const auto length = _preferences->getString(key, returnValue, space);
+        if (length == 0) {
+            _isTruncated = true;
+            return nullptr;
+        }
+        *startLocation += length;
+        return returnValue;
+    }
+
+    void Configuration::toChunkKey(const char* key, const unsigned int index, char* chunkKey) {
+        snprintf(chunkKey, MaxKeyLength + 1, "%s#%u", key, index);
+    }
+
+    Configuration::Transaction::Transaction(const Configuration* configuration) : _configuration(configuration) {}
+
+    unsigned int Configuration::Transaction::commit() {
+        _configuration->waitForLoad();
+        unsigned int written;
+        if (_configuration->_storageMode == StorageMode::Packed) {
+            written = _ip == nullptr && _wifi == nullptr && _tls == nullptr && _mqtt == nullptr && _firmware == nullptr
+                ? 0 : _configuration->putPacked(_ip, _wifi, _tls, _mqtt, _firmware);
+        }
+        else {
+            written = _configuration->putIpConfig(_ip);
+            written += _configuration->putWifiConfig(_wifi);
+            written += _configuration->putTlsConfig(_tls, _tlsFormat);
+            written += _configuration->putMqttConfig(_mqtt);
+            written += _configuration->putFirmwareConfig(_firmware);
         }
-        return nullptr;
+        _ip = nullptr;
+        _wifi = nullptr;
+        _tls = nullptr;
+        _mqtt = nullptr;
+        _firmware = nullptr;
+        return written;
+    }
+
+    Configuration::Transaction& Configuration::Transaction::putFirmwareConfig(const FirmwareConfig* firmwareConfig) {
+        _firmware = firmwareConfig;
+        return *this;
+    }
+
+    Configuration::Transaction& Configuration::Transaction::putIpConfig(const IpConfig* ipConfig) {
+        _ip = ipConfig;
+        return *this;
+    }
+
+    Configuration::Transaction& Configuration::Transaction::putMqttConfig(const MqttConfig* mqttConfig) {
+        _mqtt = mqttConfig;
+        return *this;
+    }
+
+    Configuration::Transaction& Configuration::Transaction::putTlsConfig(const TlsConfig* tlsConfig, const CertificateFormat format) {
+        _tls = tlsConfig;
+        _tlsFormat = format;
+        return *this;
+    }
+
+    Configuration::Transaction& Configuration::Transaction::putWifiConfig(const WifiConfig* wifiConfig) {
+        _wifi = wifiConfig;
+        return *this;
     }
-}
\ No newline at end of file
+}
@@ -16,8 +16,15 @@
 
 #include <IPAddress.h>
 #include <Preferences.h>
+#include <climits>
+#include <functional>
+#include <memory>
+#include <vector>
+#include "ConfigurationImage.h"
+#include "ConfigurationSchema.h"
 
 namespace Esp32NetConfig {
+    class AsyncLoader;
 
     struct IpConfig {
         IPAddress localIp;
@@ -30,6 +37,13 @@ namespace Esp32NetConfig {
     // INADDR_NONE means auto-configure
     const IpConfig IpAutoConfig{ INADDR_NONE, INADDR_NONE, INADDR_NONE, INADDR_NONE, INADDR_NONE };
 
+    // The last lease obtained via DHCP, so a wake from deep sleep can use it while DHCP runs in the background.
+    struct DhcpLease {
+        IpConfig ip;
+        uint32_t expiry;  // in the time base the caller uses for provisionalIpConfig, e.g. seconds since the epoch
+        uint8_t bssid[6]; // of the access point the lease was obtained on
+    };
+
     struct FirmwareConfig {
         const char* baseUrl;
     };
@@ -42,46 +56,447 @@ namespace Esp32NetConfig {
         bool useTls;
     };
 
+    // The MQTT broker or firmware URL split into its parts when it was put, so it needs no parsing after boot,
+    // with a cached IPv4 address of the host so the first connection needs no DNS lookup.
+    struct Endpoint {
+        const char* scheme;     // from the URL, else the default (mqtt/mqtts for the broker, http for the firmware URL)
+        const char* host;       // nullptr if there is no endpoint
+        uint16_t port;          // from the URL, else the MQTT port or the scheme's default port
+        const char* path;       // "" if none
+        IPAddress address;      // INADDR_NONE if not resolved yet
+        uint32_t addressExpiry; // in the time base the caller uses for putResolvedAddress, e.g. seconds since the epoch
+    };
+
     struct TlsConfig {
         const char* rootCaCertificate;
         const char* deviceCertificate;
         const char* devicePrivateKey;
     };
 
+    // Binary form of a PEM entry: the PEM label (e.g. "CERTIFICATE") and the DER object(s), concatenated for a chain.
+    struct DerObject {
+        const char* label;
+        const uint8_t* data;
+        size_t length;
+    };
+
+    struct TlsDerConfig {
+        DerObject rootCaCertificate;
+        DerObject deviceCertificate;
+        DerObject devicePrivateKey;
+    };
+
+    // Der stores certificates and keys in binary form, which takes about 25% less space than PEM.
+    // Entries that can't be converted (e.g. not PEM, or encrypted PEM) are stored as PEM anyway.
+    // This applies to per-key storage; the packed blob stores PEM.
+    enum class CertificateFormat : uint8_t { Pem, Der };
+
     struct WifiConfig {
         const char* ssid;
         const char* password;
         const char* deviceName;
-        uint8_t* bssid; // Format: { 0x01, 0x02, 0x03, 0x04, 0x05, 0x06 }. Use nullptr for autoconfigure
+        const uint8_t* bssid; // Format: { 0x01, 0x02, 0x03, 0x04, 0x05, 0x06 }. Use nullptr for autoconfigure
+    };
+
+    // An access point to try, with what we know from earlier connections, so a reconnect can skip the scan.
+    struct WifiProfile {
+        const char* ssid;
+        const char* password;
+        const uint8_t* bssid; // of the last successful connection; nullptr if none
+        uint8_t channel;      // of the last successful connection; 0 if none
+        uint16_t successes;
+        uint16_t failures;    // since the last success
+        uint32_t lastSuccess; // higher is more recent; 0 if never
+    };
+
+    constexpr uint8_t MaxWifiProfiles = 8;
+    // A profile that failed this many times in a row goes behind the ones that didn't
+    constexpr uint16_t WifiFailureLimit = 3;
+
+    // PerKey stores every field under its own key in a namespace per section (the original layout).
+    // Packed stores all sections as one versioned blob, so begin() needs a single read. 
+    // In packed mode, the per-key layout is still read if there is no blob yet, and migrated on the first put.
+    enum class StorageMode : uint8_t { PerKey, Packed };
+
+    // Eager loads all sections in begin(). Lazy loads a section when its accessor (e.g. mqttConfig()) is first called.
+    // With Lazy, the TLS section is only read if MQTT uses TLS. Packed storage is always loaded in one go.
+    enum class LoadMode : uint8_t { Eager, Lazy };
+
+    enum class Section : uint8_t { Ip, Wifi, Tls, Mqtt, Firmware };
+    constexpr uint8_t SectionCount = 5;
+
+    // Cost of the last load and the last store. NVS operations are the calls made to Preferences, 
+    // including begin() and end() for the namespace.
+    struct SectionStats {
+        uint32_t loadMicros;
+        uint32_t loadOperations;
+        uint32_t bufferBytes;
+        bool truncated; // a value was stored but did not fit in the buffer, and was returned as nullptr.
+        uint32_t storeMicros;
+        uint32_t storeOperations;
+        uint32_t keysWritten;
+        uint32_t writeFailures; // keys that could not be written
+    };
+
+    struct ConfigurationStats {
+        SectionStats section[SectionCount]; // indexed by Section; used in per-key mode and for the per-key fallback.
+        SectionStats packed;                // the blob in packed mode
     };
 
     class Configuration {
     public:
-        explicit Configuration(Preferences* preferences);
+        // Stages changes to any number of sections, and writes them all at once on commit(). 
+        // The staged configs are not copied, so they must stay valid until then.
+        // In packed mode, commit() is a single blob write with the next generation number. NVS replaces a blob atomically,
+        // so a reader sees either the whole old or the whole new configuration, even after a power loss during the write.
+        // In per-key mode, commit() does the put for each staged section, which is not atomic.
+        class Transaction {
+        public:
+            explicit Transaction(const Configuration* configuration);
+            Transaction& putFirmwareConfig(const FirmwareConfig* firmwareConfig);
+            Transaction& putMqttConfig(const MqttConfig* mqttConfig);
+            Transaction& putIpConfig(const IpConfig* ipConfig);
+            Transaction& putTlsConfig(const TlsConfig* tlsConfig, CertificateFormat format = CertificateFormat::Pem);
+            Transaction& putWifiConfig(const WifiConfig* wifiConfig);
+            // returns the number of keys written (or 1 if the blob was written in packed mode), and clears the staged changes.
+            unsigned int commit();
+        private:
+            const Configuration* _configuration;
+            const IpConfig* _ip = nullptr;
+            const WifiConfig* _wifi = nullptr;
+            const TlsConfig* _tls = nullptr;
+            CertificateFormat _tlsFormat = CertificateFormat::Pem;
+            const MqttConfig* _mqtt = nullptr;
+            const FirmwareConfig* _firmware = nullptr;
+        };
+
+        // Values are imported in chunks of this size, and certificates larger than that are stored in chunks as well.
+        static constexpr size_t ChunkSize = 256;
+
+        // Reads a configuration stream (as written by Exporter) in pieces of any size, and stages it while it comes in.
+        // Memory use is fixed, whatever the size of the certificates. The stream is a header ('N', 'C', version 1) 
+        // followed by records: a field number (1 byte), the value length (4 bytes, little endian) and the value. 
+        // Field number 254 starts a section (the value is the Section), 255 ends the stream. Records with unknown field 
+        // numbers are skipped.
+        // An import replaces the sections in the stream. They are staged in their own namespaces, and only stored (and their
+        // generations bumped) by finish() after the end record came in: per key through the window, or in packed mode
+        // as one blob write, which needs the staged sections and the blob in memory like a put does.
+        class Importer {
+        public:
+            explicit Importer(const Configuration* configuration);
+            // Discards what was staged if finish() was not called.
+            ~Importer();
+            // Returns false if the stream is not valid. The rest of it is then ignored, and what was staged is discarded.
+            // A namespace is only open while a value or chunk is stored, so the Configuration can be used between writes.
+            bool write(const uint8_t* data, size_t size);
+            // Closes the import, and stores it if the whole stream was received. Returns true if it was stored.
+            bool finish();
+        private:
+            enum class State : uint8_t { StreamHeader, RecordHeader, Value, End, Failed };
+            static constexpr size_t HeaderSize = 5;
+            static constexpr uint8_t NoSection = 0xFF;
+            void commitPacked();
+            void commitPerKey(uint8_t section);
+            bool copyStaged(uint8_t section, const char* key, FieldType type);
+            void discardStaged();
+            bool fail();
+            void loadStaged(Configuration& staged) const;
+            // Makes the section the one values are staged in, and clears its staging namespace on first use.
+            void selectSection(uint8_t section);
+            void putEndpoint(Section section);
+            bool startValue();
+            void storeValue();
+            void storeChunk();
+            const Configuration* _configuration;
+            State _state = State::StreamHeader;
+            uint8_t _header[HeaderSize];
+            size_t _headerLength = 0;
+            uint8_t _field = 0;
+            bool _isKnownField = false;
+            uint32_t _remaining = 0;
+            unsigned int _chunkIndex = 0;
+            char _window[ChunkSize + 1];
+            size_t _windowLength = 0;
+            uint8_t _section = NoSection;
+            uint8_t _importedSections = 0;
+        };
+
+        // Writes the configuration as a stream that Importer can read, in pieces of any size. 
+        // It copies straight from the buffer, so apart from a record header it needs no memory of its own.
+        // All sections are loaded first, including the PEM text of entries stored as DER. If a value did not fit in the
+        // buffer, the export is not valid and read() returns 0 right away, as the import would replace the section without it.
+        class Exporter {
+        public:
+            explicit Exporter(Configuration* configuration);
+            // Copies the next part of the stream into buffer. Returns the number of bytes copied, 0 at the end.
+            size_t read(uint8_t* buffer, size_t size);
+            // False if a value did not fit in the buffer (see requiredBufferSize), so nothing is exported.
+            bool isValid() const;
+        private:
+            static constexpr size_t HeaderSize = 5;
+            bool fieldValue(uint8_t field);
+            bool nextRecord();
+            const Configuration* _configuration;
+            bool _isStarted = false;
+            bool _isEnded = false;
+            bool _isValid;
+            uint8_t _nextSection = 0;
+            uint8_t _nextField = 0;
+            uint8_t _header[HeaderSize];
+            size_t _headerLength = 0;
+            size_t _headerOffset = 0;
+            uint8_t _number[sizeof(uint32_t)];
+            const uint8_t* _value = nullptr;
+            uint32_t _valueLength = 0;
+            uint32_t _valueOffset = 0;
+        };
+
+        static constexpr size_t DefaultBufferSize = 8192;
+        // The longest string (e.g. a PEM certificate chain) that packed mode and images can hold
+        static constexpr size_t MaxPackedStringLength = UINT16_MAX - 1;
+        static constexpr unsigned int WriteFailed = UINT_MAX;
+        // Uses a buffer of DefaultBufferSize bytes on the heap for the loaded strings.
+        explicit Configuration(Preferences* preferences, StorageMode storageMode = StorageMode::PerKey);
+        // Uses the caller's buffer (e.g. sized via requiredBufferSize, or in PSRAM). It must outlive the Configuration.
+        Configuration(Preferences* preferences, char* buffer, size_t bufferSize, StorageMode storageMode = StorageMode::PerKey);
+        // Waits for a background load by beginAsync()
+        ~Configuration();
+        static constexpr uint8_t MaxUserSections = 4;
+        // The number of buffer bytes begin() needs for what is stored now, not counting application sections.
+        static size_t requiredBufferSize(Preferences* preferences, StorageMode storageMode = StorageMode::PerKey);
         IpConfig ip{};
         MqttConfig mqtt{};
         TlsConfig tls{};
+        // Entries stored as DER. Their PEM counterparts in tls stay nullptr until tlsConfig() rebuilds them.
+        TlsDerConfig tlsDer{};
         WifiConfig wifi{};
+        // Loaded with the Wi-Fi section, best first: the most recent success first, then the ones that never connected
+        // in the order they were put, and then the ones that failed WifiFailureLimit times since their last success.
+        WifiProfile wifiProfiles[MaxWifiProfiles]{};
+        uint8_t wifiProfileCount = 0;
         FirmwareConfig firmware{};
-        void begin();
-        void putFirmwareConfig(const FirmwareConfig* firmwareConfig) const;
-        void putMqttConfig(const MqttConfig* mqttConfig) const;
-        void putIpConfig(const IpConfig* ipConfig) const;
-        void putTlsConfig(const TlsConfig* tlsConfig) const;
-        void putWifiConfig(const WifiConfig* wifiConfig) const;
+        // Adds an application section, which begin() loads per key from its own namespace into the struct that 'data'
+        // points to (in both storage modes and load modes). reload() does not look at it. The descriptor and the struct
+        // must outlive the Configuration. Returns false if there are MaxUserSections already.
+        bool addSection(const SectionDescriptor* section, void* data);
+        // Uses the image for the built-in sections that were never put, pointing their values into it instead of
+        // copying them into the buffer. Preferences stays the writable layer on top: a put section is loaded from there.
+        // In packed mode that applies only if there is no blob; the first put then takes the image sections into the blob.
+        // The image must outlive the Configuration.
+        // Wi-Fi profiles, the lease and the endpoints are always in Preferences.
+        void attachImage(const ConfigurationImage* image);
+        // Builds an image of everything stored now, e.g. to write into the partition that ConfigurationImage maps.
+        // Returns false if a value is too long for the image (MaxPackedStringLength).
+        bool buildImage(std::vector<uint8_t>& image);
+        // Builds an image of these sections without Preferences, e.g. on a host that provisions many devices.
+        static bool buildImage(const IpConfig& ipConfig, const WifiConfig& wifiConfig, const TlsConfig& tlsConfig,
+                               const MqttConfig& mqttConfig, const FirmwareConfig& firmwareConfig, std::vector<uint8_t>& image);
+        // Loaded with the MQTT and firmware sections
+        Endpoint mqttEndpoint{};
+        Endpoint firmwareEndpoint{};
+        void begin(LoadMode loadMode = LoadMode::Eager);
+        // Loads all sections on a background thread (in the order of Section) and returns right away, so other boot 
+        // work can go on meanwhile. Once waitForSection() returned for a section, its struct (e.g. wifi), its accessor 
+        // (e.g. wifiConfig()), and what is loaded with it (the profiles, the endpoint, tlsDer) can be used, as can the
+        // application sections. Everything else waits until the whole load is done: begin(), reload(), tlsConfig(), get(),
+        // set(), the put methods, stats() and so on. Don't use the Preferences object for anything else until then.
+        void beginAsync();
+        // Returns when the section was loaded by beginAsync(), or right away if there is no background load.
+        void waitForSection(Section section);
+        // Returns when beginAsync() loaded everything, or right away if there is no background load.
+        void waitForLoad() const;
+        // Re-reads only the loaded sections whose generation changed since they were loaded, and then calls their
+        // change handlers. The changed sections are added at the end of the buffer, so the values of the other sections
+        // stay where they are. If there is not enough room, everything is reloaded and all loaded sections count as changed.
+        // Returns the number of changed sections.
+        unsigned int reload();
+        // Called by reload() after the section changed, e.g. to reconnect MQTT without touching Wi-Fi.
+        void onChange(Section section, std::function<void()> handler);
+        Transaction beginTransaction() const;
+        Importer beginImport() const;
+        Exporter beginExport();
+        const IpConfig& ipConfig();
+        const WifiConfig& wifiConfig();
+        // Rebuilds the PEM text for entries stored as DER, which takes extra buffer space (included in requiredBufferSize).
+        const TlsConfig& tlsConfig();
+        const TlsDerConfig& tlsDerConfig();
+        const MqttConfig& mqttConfig();
+        const FirmwareConfig& firmwareConfig();
+        // The endpoint of the MQTT or the firmware section (others have none).
+        const Endpoint& endpoint(Section section);
+        // The put methods only write keys whose value differs from what is stored (nullptr removes the key).
+        // They return the number of keys written or removed; in packed mode, that is 1 if the blob was written,
+        // and WriteFailed if it could not be (a value longer than MaxPackedStringLength, or a failed write).
+        unsigned int putFirmwareConfig(const FirmwareConfig* firmwareConfig) const;
+        unsigned int putMqttConfig(const MqttConfig* mqttConfig) const;
+        unsigned int putIpConfig(const IpConfig* ipConfig) const;
+        unsigned int putTlsConfig(const TlsConfig* tlsConfig, CertificateFormat format = CertificateFormat::Pem) const;
+        unsigned int putWifiConfig(const WifiConfig* wifiConfig) const;
+        // Reads or writes a single field by its name, <namespace>.<key> as in Preferences (e.g. "mqtt.port"). The name is
+        // found in constant time. Values are text: addresses as a.b.c.d, numbers in decimal, booleans as true or false, a 
+        // BSSID as six hex bytes separated by colons (e.g. 01:02:03:04:05:a6), and strings and PEM as they are. 
+        // Empty text means "not set" (except for booleans), e.g. the default port or a removed password.
+        // get() loads the section if needed, and returns false if the name is unknown or the value (with terminator)
+        // does not fit in 'size' bytes.
+        bool get(const char* name, char* value, size_t size);
+        // set() writes only that key if it changed (stored as PEM for a certificate), and bumps the section generation. 
+        // In packed mode it writes the blob with only that value changed. A section that is still in the attached image
+        // is written as a whole. Like the put methods, it does not change the loaded values (see reload).
+        // Returns false if the name is unknown, the value is not valid for the field, or it could not be stored.
+        bool set(const char* name, const char* value);
+        // Puts an application section per key, in both storage modes. 
+        unsigned int putSection(const SectionDescriptor* section, const void* data) const;
+        // Stores up to MaxWifiProfiles profiles in order of preference, in the wifi namespace (in packed mode, in the blob once there is one).
+        // Profiles with an SSID that was stored already keep what was learned about them. Returns 1 if written.
+        // Profiles are not part of the section generation, so reload() does not look for changes in them.
+        unsigned int putWifiProfiles(const WifiProfile* profiles, uint8_t count) const;
+        // Records the outcome of a connection attempt to a stored profile (bssid and channel are only used on success). 
+        // Returns 1 if written.
+        unsigned int recordWifiResult(const char* ssid, bool isConnected, const uint8_t* bssid = nullptr, uint8_t channel = 0) const;
+        // Stores the lease in the ip namespace (in both storage modes), only if it changed. nullptr removes it. 
+        // Returns 1 if written or removed. Like the profiles, the lease is not part of the section generation.
+        unsigned int putDhcpLease(const DhcpLease* lease) const;
+        // The IP configuration to start with: the configured one if it is static, else the stored lease if it did not
+        // expire at 'now' and was obtained on the access point with this BSSID, else IpAutoConfig (i.e. wait for DHCP).
+        IpConfig provisionalIpConfig(uint32_t now, const uint8_t* bssid);
+        // Caches the resolved address of the MQTT or firmware endpoint, e.g. after a DNS lookup in the background.
+        // Returns 1 if written. Putting a different host in the section drops the cached address.
+        // A section that still comes from an attached image gets its endpoint record in Preferences here.
+        unsigned int putResolvedAddress(Section section, const IPAddress& address, uint32_t expiry) const;
         int freeBufferSpace() const;
+        // Statistics of the last load (begin or lazy load) and last store per section.
+        const ConfigurationStats& stats() const;
+        // The generation of the loaded packed blob. It goes up by one with every blob write (0 if there is no blob).
+        uint32_t generation() const;
+        // The generation of a loaded section. It goes up with every put that changes the section.
+        uint32_t generation(Section section) const;
     private:
-        static constexpr int BufferSize = 8192;
-        Preferences* _preferences;
-        char _buffer[BufferSize] = { 0 };
-        char* _next = _buffer;
+        static constexpr uint8_t AllSections = (1 << SectionCount) - 1;
+        static constexpr uint8_t AllFields = UINT8_MAX;
+
+        // Counts the calls made via ->, which are the NVS operations in the statistics, and the writes that failed
+        struct CountedPreferences {
+            Preferences* preferences;
+            mutable uint32_t operations;
+            mutable uint32_t writeFailures;
+            Preferences* operator->() const;
+        };
+
+        struct Measurement {
+            unsigned long startMicros;
+            uint32_t startOperations;
+            uint32_t startWriteFailures;
+        };
+
+        struct UserSection {
+            const SectionDescriptor* descriptor;
+            void* data;
+        };
+
+        CountedPreferences _preferences;
+        mutable ConfigurationStats _stats{};
+        bool _isTruncated = false;
+        // the packed blob did not fit, so its sections are missing
+        bool _isBlobTruncated = false;
+        // the loaded sections that miss a value because it did not fit in the buffer
+        uint8_t _truncatedSections = 0;
+        StorageMode _storageMode;
+        uint32_t _generation = 0;
+        uint8_t _loadedSections = 0;
+        std::unique_ptr<char[]> _ownedBuffer;
+        char* _buffer;
+        size_t _bufferSize;
+        char* _next;
+        bool _isDryRun = false;
+        size_t _requiredSize = 0;
+        LoadMode _loadMode = LoadMode::Eager;
+        uint32_t _sectionGeneration[SectionCount]{};
+        char* _sectionEnd[SectionCount]{};
+        char* _sectionStart[SectionCount]{};
+        std::vector<std::function<void()>> _changeHandlers[SectionCount];
+        UserSection _userSections[MaxUserSections]{};
+        uint8_t _userSectionCount = 0;
+        const ConfigurationImage* _image = nullptr;
+        // the background load of beginAsync(), until begin() is called again
+        std::unique_ptr<AsyncLoader> _asyncLoader;
+        bool adoptSection(Section section, const Configuration& source);
+        static bool appendRecord(uint8_t tag, const std::vector<uint8_t>& data, std::vector<uint8_t>& blob);
+        static bool applyWifiResult(WifiProfile* profiles, uint8_t count, const char* ssid, bool isConnected, const uint8_t* bssid, uint8_t channel);
+        void clearSection(Section section) const;
+        void bumpGeneration() const;
+        void copyFields(const SectionDescriptor& section, const void* source, void* target, bool isIntoBuffer);
+        void copyRecords(Section section, const Configuration& source);
+        const char* copyString(const char* value);
+        char* copyToBuffer(const void* value, size_t size);
+        unsigned int countWrite(bool isWritten) const;
+        DerObject& derObject(uint8_t index);
+        static FieldType effectiveType(const SectionDescriptor& section, const FieldDescriptor& field);
+        static bool isEqual(const SectionDescriptor& section, const void* first, const void* second);
+        static bool isEqual(const char* first, const char* second);
+        char* loadFields(const SectionDescriptor& section, void* data, char* start);
+        void loadUserSections();
+        unsigned int putField(const SectionDescriptor& section, uint8_t index, const void* data, CertificateFormat format) const;
+        unsigned int putFields(const SectionDescriptor& section, const void* data, CertificateFormat format) const;
+        unsigned int putSectionPerKey(Section section, const void* data, CertificateFormat format = CertificateFormat::Pem,
+                                      uint8_t field = AllFields) const;
+        void* sectionData(Section section);
+        const void* sectionData(Section section) const;
+        char* storeBytesToBuffer(const char* key, size_t size, char** startLocation);
+        static uint32_t endpointHash(const char* source, const char* defaultScheme, uint16_t defaultPort);
+        static bool packEndpoint(const char* source, const char* defaultScheme, uint16_t defaultPort, std::vector<uint8_t>& blob);
+        static bool parseEndpoint(char* blob, size_t size, Endpoint& endpoint, uint32_t& sourceHash);
+        static bool useEndpoint(char* blob, size_t size, const char* source, const char* defaultScheme, uint16_t defaultPort, Endpoint& endpoint);
+        static void keepAddress(const Endpoint& known, std::vector<uint8_t>& blob);
+        unsigned int putEndpoint(const char* source, const char* defaultScheme, uint16_t defaultPort) const;
+        void putEndpointOf(Section section, const void* data) const;
+        char* storeEndpointToBuffer(const char* source, const char* defaultScheme, uint16_t defaultPort, Endpoint& endpoint, char* start);
+        char* storeExtrasToBuffer(Section section, char* start);
+        void notifyChanges(uint8_t changedSections);
+        uint8_t reloadPacked(const Configuration& latest);
+        uint8_t reloadPerKey();
+        unsigned int removeChunks(const char* key) const;
+        const char* storeCertificateToBuffer(const char* pemKey, const char* derKey, DerObject& der, char** startLocation);
+        char* storeChunksToBuffer(const char* key, char** startLocation);
+        static void toChunkKey(const char* key, unsigned int index, char* chunkKey);
+        uint32_t storedGeneration(Section section) const;
         char* storeToBuffer(const char* key, char** startLocation);
-        char* getFirmwareConfig(char* start);
-        void getIpConfig();
-        char* getMqttConfig(char* start);
-        char* getTlsConfig(char* start);
-        char* getWifiConfig(char* start);
-        void putStringIfNotNull(const char* key, const char* value) const;
+        const char* pemToBuffer(const DerObject& der);
+        // Returns false if a PEM text did not fit in the buffer
+        bool rebuildPem();
+        DerObject storeDerToBuffer(const char* key, char** startLocation);
+        // Returns the offset of the records after the strings, or 0 if the blob is not valid.
+        size_t parsePacked(const char* blob, size_t size, uint8_t sections);
+        void parseRecords(char* blob, size_t offset, size_t size);
+        static void packProfiles(const WifiProfile* profiles, uint8_t count, std::vector<uint8_t>& blob);
+        static uint8_t parseProfiles(char* blob, size_t size, WifiProfile* profiles);
+        static void mergeProfiles(const WifiProfile* profiles, uint8_t count, const WifiProfile* stored, uint8_t storedCount, WifiProfile* merged);
+        unsigned int putProfiles(const WifiProfile* profiles, uint8_t count) const;
+        uint8_t readProfiles(std::vector<char>& blob, WifiProfile* profiles) const;
+        static void sortProfiles(WifiProfile* profiles, uint8_t count);
+        char* storeProfilesToBuffer(char* start);
+        bool isLoaded(Section section) const;
+        // Waits for the section if beginAsync() loads it. Returns false if there is no background load.
+        bool isLoadedAsync(Section section);
+        Measurement startMeasurement() const;
+        void recordLoad(SectionStats& stats, const Measurement& measurement, const char* start);
+        void recordStore(SectionStats& stats, const Measurement& measurement, unsigned int keysWritten) const;
+        // begin() without waiting, as the background load of beginAsync() runs it
+        void load(LoadMode loadMode);
+        void loadSection(Section section);
+        bool loadPacked();
+        // Returns false if a string is longer than MaxPackedStringLength. Images are packed without the records.
+        bool pack(std::vector<uint8_t>& blob, bool isWithRecords) const;
+        unsigned int putBoolIfChanged(const char* key, bool value) const;
+        unsigned int putCertificateIfChanged(const char* pemKey, const char* derKey, const char* pem, CertificateFormat format) const;
+        unsigned int putBytesIfChanged(const char* key, const void* value, size_t size) const;
+        // With a field, only that field of the section that is put changes.
+        unsigned int putPacked(const IpConfig* ipConfig, const WifiConfig* wifiConfig, const TlsConfig* tlsConfig, 
+                               const MqttConfig* mqttConfig, const FirmwareConfig* firmwareConfig, uint8_t field = AllFields) const;
+        bool putPackedRecords(const std::function<void(Configuration&)>& update, SectionStats& stats, unsigned int& written) const;
+        unsigned int writePacked(std::vector<uint8_t>& blob, uint32_t generation) const;
+        unsigned int putStringIfChanged(const char* key, const char* value) const;
+        unsigned int putUIntIfChanged(const char* key, uint32_t value) const;
+        unsigned int removeIfExists(const char* key) const;
     };
 }
 #endif
@@ -0,0 +1,98 @@
+// Copyright 2024 Rik Essenius
+//
+// Licensed under the Apache License, Version 2.0 (the "License"); you may not use this file
+// except in compliance with the License. You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software distributed under the License
+// is distributed on an "AS IS" BASIS WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and limitations under the License.
+
+#include "ConfigurationImage.h"
+
+#ifdef ESP_PLATFORM
+#include <esp_partition.h>
+#elif defined(_WIN32)
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace Esp32NetConfig {
+
+#ifdef ESP_PLATFORM
+    ConfigurationImage::ConfigurationImage(const char* name) {
+        const auto partition = esp_partition_find_first(ESP_PARTITION_TYPE_DATA, ESP_PARTITION_SUBTYPE_ANY, name);
+        if (partition == nullptr) return;
+        const void* data;
+        esp_partition_mmap_handle_t handle;
+        if (esp_partition_mmap(partition, 0, partition->size, ESP_PARTITION_MMAP_DATA, &data, &handle) != ESP_OK) return;
+        _data = static_cast<const char*>(data);
+        _size = partition->size;
+        _handle = handle;
+    }
+
+    ConfigurationImage::~ConfigurationImage() {
+        if (_data != nullptr) esp_partition_munmap(_handle);
+    }
+#elif defined(_WIN32)
+    ConfigurationImage::ConfigurationImage(const char* name) {
+        const auto file = CreateFileA(name, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+        if (file == INVALID_HANDLE_VALUE) return;
+        LARGE_INTEGER size;
+        if (GetFileSizeEx(file, &size) && size.QuadPart > 0) {
+            const auto mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+            if (mapping != nullptr) {
+                const auto data = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+                if (data != nullptr) {
+                    _data = static_cast<const char*>(data);
+                    _size = static_cast<size_t>(size.QuadPart);
+                }
+                // the view keeps the mapping alive
+                CloseHandle(mapping);
+            }
+        }
+        CloseHandle(file);
+    }
+
+    ConfigurationImage::~ConfigurationImage() {
+        if (_data != nullptr) UnmapViewOfFile(_data);
+    }
+#else
+    ConfigurationImage::ConfigurationImage(const char* name) {
+        const auto file = open(name, O_RDONLY);
+        if (file < 0) return;
+        struct stat status {};
+        if (fstat(file, &status) == 0 && status.st_size > 0) {
+            const auto size = static_cast<size_t>(status.st_size);
+            const auto data = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, file, 0);
+            if (data != MAP_FAILED) {
+                _data = static_cast<const char*>(data);
+                _size = size;
+            }
+        }
+        // the mapping stays valid without the file descriptor
+        close(file);
+    }
+
+    ConfigurationImage::~ConfigurationImage() {
+        if (_data != nullptr) munmap(const_cast<char*>(_data), _size);
+    }
+#endif
+
+    bool ConfigurationImage::isMapped() const {
+        return _data != nullptr;
+    }
+
+    const char* ConfigurationImage::data() const {
+        return _data;
+    }
+
+    size_t ConfigurationImage::size() const {
+        return _size;
+    }
+}
@@ -0,0 +1,42 @@
+// Copyright 2024 Rik Essenius
+//
+// Licensed under the Apache License, Version 2.0 (the "License"); you may not use this file
+// except in compliance with the License. You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software distributed under the License
+// is distributed on an "AS IS" BASIS WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and limitations under the License.
+
+// A read-only configuration image in the packed format, mapped into memory: a data partition on the ESP32,
+// a file elsewhere. A Configuration that uses it points its strings straight into the mapping instead of
+// copying them into its buffer. See Configuration::attachImage and Configuration::buildImage.
+
+#ifndef HEADER_CONFIGURATION_IMAGE
+#define HEADER_CONFIGURATION_IMAGE
+
+#include <cstddef>
+#include <cstdint>
+
+namespace Esp32NetConfig {
+    class ConfigurationImage {
+    public:
+        // On the ESP32, 'name' is the label of a data partition; elsewhere, it is the path of an image file.
+        // Not mapped if it does not exist or cannot be mapped.
+        explicit ConfigurationImage(const char* name);
+        ConfigurationImage(const ConfigurationImage&) = delete;
+        ConfigurationImage& operator=(const ConfigurationImage&) = delete;
+        ~ConfigurationImage();
+        bool isMapped() const;
+        // nullptr if not mapped. A partition is mapped as a whole, so the size can be more than the image.
+        const char* data() const;
+        size_t size() const;
+    private:
+        const char* _data = nullptr;
+        size_t _size = 0;
+        // the mmap handle of the partition on the ESP32
+        uint32_t _handle = 0;
+    };
+}
+#endif
@@ -0,0 +1,96 @@
+// Copyright 2024 Rik Essenius
+// 
+// Licensed under the Apache License, Version 2.0 (the "License"); you may not use this file
+// except in compliance with the License. You may obtain a copy of the License at
+// 
+//     http://www.apache.org/licenses/LICENSE-2.0
+// 
+// Unless required by applicable law or agreed to in writing, software distributed under the License
+// is distributed on an "AS IS" BASIS WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and limitations under the License.
+
+// The namespaces and keys of the per-key layout. Internal to the library.
+
+#ifndef HEADER_CONFIGURATION_KEYS
+#define HEADER_CONFIGURATION_KEYS
+
+#include <cstddef>
+#include "ConfigurationSchema.h"
+
+namespace Esp32NetConfig {
+    constexpr auto Ip = "ip";
+
+    constexpr auto Local = "local";
+    constexpr auto Gateway = "gateway";
+    constexpr auto SubnetMask = "subnetMask";
+    constexpr auto Dns1 = "dns1";
+    constexpr auto Dns2 = "dns2";
+    // not part of the IP section keys, like Profiles
+    constexpr auto Lease = "lease";
+
+    // in the mqtt and firmware namespaces: the parsed broker or URL and the cached address (in packed mode, in the blob)
+    constexpr auto EndpointParts = "endpoint";
+
+    constexpr auto Mqtt = "mqtt";
+    constexpr auto Broker = "broker";
+    constexpr auto Port = "port";
+    constexpr auto User = "user";
+    constexpr auto Password = "password";
+    constexpr auto UseTls = "useTls";
+    constexpr uint16_t DefaultMqttPort = 1883;
+
+    constexpr auto Wifi = "wifi";
+    constexpr auto DeviceName = "deviceName";
+    constexpr auto Ssid = "ssid";
+    constexpr auto Bssid = "bssid";
+    constexpr size_t BssidSize = 6;
+    // not part of the Wi-Fi section keys: kept in packed mode, and when the section is replaced
+    constexpr auto Profiles = "profiles";
+
+    constexpr auto Tls = "tls";
+    constexpr auto RootCaCert = "rootCaCert";
+    constexpr auto DeviceCert = "deviceCert";
+    constexpr auto DeviceKey = "deviceKey";
+    constexpr auto RootCaDer = "rootCaDer";
+    constexpr auto DeviceCertDer = "deviceCertDer";
+    constexpr auto DeviceKeyDer = "deviceKeyDer";
+
+    constexpr auto Firmware = "firmware";
+    constexpr auto Url = "url";
+
+    constexpr auto Config = "config";
+    constexpr auto Packed = "packed";
+
+    // every section namespace has a generation key, which goes up with each put that changes the section
+    constexpr auto Generation = "generation";
+    // indexed by Section
+    constexpr const char* SectionNamespaces[] = { Ip, Wifi, Tls, Mqtt, Firmware };
+    // where Importer stages the sections until the whole stream came in, indexed by Section
+    constexpr const char* ImportNamespaces[] = { "import.ip", "import.wifi", "import.tls", "import.mqtt", "import.firmware" };
+    // The built-in sections, indexed by Section, are slices of BuiltInFields (see ConfigurationSchema.cpp).
+    // The position of a field in BuiltInFields is also its number in the stream format.
+    constexpr uint8_t BuiltInFieldCount = 18;
+    extern const FieldDescriptor BuiltInFields[BuiltInFieldCount];
+    extern const SectionDescriptor BuiltInSections[];
+    // The section (a Section value) of the field with this number
+    uint8_t sectionOf(uint8_t field);
+    // The number of the field named <namespace>.<key> (e.g. "mqtt.port"), or BuiltInFieldCount if there is none.
+    // It takes one hash and one compare: the hash is perfect for the names, as found by the compiler.
+    uint8_t findField(const char* name);
+    // The text form of values, as Configuration::get() and set() use it. parseValue() points a string member to 'text',
+    // and a BSSID member to 'bssid' (BssidSize bytes). Both return false if the text is not valid or does not fit.
+    bool parseValue(FieldType type, const char* text, void* member, uint8_t* bssid);
+    // parseValue() for the built-in field with this number, which also checks its range (e.g. a port is at most 65535)
+    bool parseField(uint8_t number, const char* text, void* member, uint8_t* bssid);
+    bool formatValue(FieldType type, const void* member, char* text, size_t size);
+    // indexed by the position of the Certificate field in the TLS section
+    constexpr const char* CertificateDerKeys[] = { RootCaDer, DeviceCertDer, DeviceKeyDer };
+
+    // indexed by Section: the key in the namespace that is kept when the section is cleared
+    constexpr const char* SectionKeptKeys[] = { Lease, Profiles, nullptr, nullptr, nullptr };
+
+    // NVS limits key names to 15 characters. Imported PEM values that are larger than a chunk are stored 
+    // in pieces under the keys <key>#0, <key>#1 etc.
+    constexpr size_t MaxKeyLength = 15;
+}
+#endif
@@ -0,0 +1,232 @@
+// Copyright 2024 Rik Essenius
+//
+// Licensed under the Apache License, Version 2.0 (the "License"); you may not use this file
+// except in compliance with the License. You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software distributed under the License
+// is distributed on an "AS IS" BASIS WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and limitations under the License.
+
+// The built-in sections, and the lookup and text form of their fields. The tables are constant-initialized,
+// so they stay in flash.
+
+#include <cctype>
+#include <cerrno>
+#include <climits>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include "Configuration.h"
+#include "ConfigurationKeys.h"
+
+namespace Esp32NetConfig {
+
+    // IpConfig holds IPAddress objects, which are not standard-layout (they are Printable), so offsetof does not apply
+    constexpr uint16_t ipOffset(const uint8_t index) { return static_cast<uint16_t>(index * sizeof(IPAddress)); }
+    static_assert(sizeof(IpConfig) == 5 * sizeof(IPAddress), "ipOffset needs the addresses in IpConfig to be contiguous");
+
+    constexpr uint8_t PortField = 1;
+
+    // Load order within a section, and the field numbers in the stream format
+    constexpr FieldDescriptor BuiltInFields[BuiltInFieldCount] = {
+        { Local, FieldType::Address, ipOffset(0), 0, 0 },
+        { Gateway, FieldType::Address, ipOffset(1), 0, 0 },
+        { SubnetMask, FieldType::Address, ipOffset(2), 0, 0 },
+        { Dns1, FieldType::Address, ipOffset(3), 0, 0 },
+        { Dns2, FieldType::Address, ipOffset(4), 0, 0 },
+
+        { DeviceName, FieldType::String, offsetof(WifiConfig, deviceName), 0, 0 },
+        { Ssid, FieldType::String, offsetof(WifiConfig, ssid), 0, 0 },
+        { Password, FieldType::String, offsetof(WifiConfig, password), 0, 0 },
+        { Bssid, FieldType::Bssid, offsetof(WifiConfig, bssid), 0, 0 },
+
+        { RootCaCert, FieldType::Certificate, offsetof(TlsConfig, rootCaCertificate), 0, 0 },
+        { DeviceCert, FieldType::Certificate, offsetof(TlsConfig, deviceCertificate), 0, 0 },
+        { DeviceKey, FieldType::Certificate, offsetof(TlsConfig, devicePrivateKey), 0, 0 },
+
+        { Broker, FieldType::String, offsetof(MqttConfig, broker), 0, 0 },
+        { Port, FieldType::UInt, offsetof(MqttConfig, port), DefaultMqttPort, 0 },
+        { User, FieldType::String, offsetof(MqttConfig, user), 0, 0 },
+        { Password, FieldType::String, offsetof(MqttConfig, password), 0, 0 },
+        // TLS by default if the port is not the default
+        { UseTls, FieldType::Bool, offsetof(MqttConfig, useTls), 0, defaultIfChanged(PortField) },
+
+        { Url, FieldType::String, offsetof(FirmwareConfig, baseUrl), 0, 0 }
+    };
+
+    constexpr SectionDescriptor BuiltInSections[SectionCount] = {
+        { Ip, BuiltInFields, 5 },
+        { Wifi, BuiltInFields + 5, 4 },
+        { Tls, BuiltInFields + 9, 3 },
+        { Mqtt, BuiltInFields + 12, 5 },
+        { Firmware, BuiltInFields + 17, 1 }
+    };
+
+    constexpr uint8_t sectionOf(const uint8_t field, const uint8_t section) {
+        return BuiltInSections[section].fields <= BuiltInFields + field ? section : sectionOf(field, section - 1);
+    }
+
+    uint8_t sectionOf(const uint8_t field) {
+        return sectionOf(field, SectionCount - 1);
+    }
+
+    // Field names (<namespace>.<key>) are hashed with FNV-1a, starting from a seed. The compiler tries seeds until every
+    // name gets its own slot, and fills NameTable with the field number per slot.
+    // Adding a field may need a larger slot count or seed range; the static_assert tells.
+    constexpr uint8_t NameSlotCount = 64;
+    constexpr uint32_t MaxNameSeed = 4096;
+    constexpr uint32_t NoSeed = UINT32_MAX;
+    constexpr uint32_t FnvPrime = 16777619u;
+
+    constexpr uint32_t hashStep(const uint32_t hash, const char character) {
+        return (hash ^ static_cast<uint8_t>(character)) * FnvPrime;
+    }
+
+    constexpr uint32_t hashText(const char* text, const uint32_t hash) {
+        return *text == 0 ? hash : hashText(text + 1, hashStep(hash, *text));
+    }
+
+    constexpr uint8_t nameSlot(const uint8_t field, const uint32_t seed) {
+        return static_cast<uint8_t>(
+            hashText(BuiltInFields[field].key, hashStep(hashText(BuiltInSections[sectionOf(field, SectionCount - 1)].name, seed), '.')) % NameSlotCount);
+    }
+
+    constexpr bool hasOwnSlot(const uint8_t field, const uint8_t other, const uint32_t seed) {
+        return other >= BuiltInFieldCount || (nameSlot(field, seed) != nameSlot(other, seed) && hasOwnSlot(field, other + 1, seed));
+    }
+
+    constexpr bool isPerfect(const uint32_t seed, const uint8_t field = 0) {
+        return field >= BuiltInFieldCount || (hasOwnSlot(field, field + 1, seed) && isPerfect(seed, field + 1));
+    }
+
+    // Splits the range in halves, so the recursion depth stays at log2 of the number of seeds
+    constexpr uint32_t findSeed(uint32_t from, uint32_t count);
+
+    constexpr uint32_t seedOr(const uint32_t found, const uint32_t from, const uint32_t count) {
+        return found != NoSeed ? found : findSeed(from, count);
+    }
+
+    constexpr uint32_t findSeed(const uint32_t from, const uint32_t count) {
+        return count == 1 ? (isPerfect(from) ? from : NoSeed) : seedOr(findSeed(from, count / 2), from + count / 2, count - count / 2);
+    }
+
+    constexpr uint32_t NameSeed = findSeed(0, MaxNameSeed);
+    static_assert(NameSeed != NoSeed, "No perfect hash for the field names: increase NameSlotCount or MaxNameSeed");
+
+    constexpr uint8_t slotField(const uint8_t slot, const uint8_t field = 0) {
+        return field >= BuiltInFieldCount || nameSlot(field, NameSeed) == slot ? field : slotField(slot, field + 1);
+    }
+
+    // NameTable<0, 1, ..., NameSlotCount - 1>::fields has the field number per slot (BuiltInFieldCount if none)
+    template <uint8_t... Slots> struct NameTable {
+        static const uint8_t fields[sizeof...(Slots)];
+    };
+
+    template <uint8_t... Slots> const uint8_t NameTable<Slots...>::fields[] = { slotField(Slots)... };
+
+    template <uint8_t Count, uint8_t... Slots> struct MakeNameTable : MakeNameTable<Count - 1, Count - 1, Slots...> {};
+
+    template <uint8_t... Slots> struct MakeNameTable<0, Slots...> {
+        using Table = NameTable<Slots...>;
+    };
+
+    uint8_t findField(const char* name) {
+        if (name == nullptr) return BuiltInFieldCount;
+        auto hash = NameSeed;
+        for (auto character = name; *character != 0; character++) hash = hashStep(hash, *character);
+        const auto field = MakeNameTable<NameSlotCount>::Table::fields[hash % NameSlotCount];
+        if (field == BuiltInFieldCount) return field;
+        // other text can have the same slot
+        const auto section = BuiltInSections[sectionOf(field)].name;
+        const auto length = strlen(section);
+        const bool isMatch = strncmp(name, section, length) == 0 && name[length] == '.' && strcmp(name + length + 1, BuiltInFields[field].key) == 0;
+        return isMatch ? field : BuiltInFieldCount;
+    }
+
+    bool parseValue(const FieldType type, const char* text, void* member, uint8_t* bssid) {
+        if (text == nullptr) return false;
+        const bool isEmpty = *text == 0;
+        char end;
+        switch (type) {
+        case FieldType::Address: {
+            unsigned int part[4]{};
+            if (!isEmpty && sscanf(text, "%u.%u.%u.%u%c", &part[0], &part[1], &part[2], &part[3], &end) != 4) return false;
+            for (const auto number : part) {
+                if (number > UINT8_MAX) return false;
+            }
+            *static_cast<IPAddress*>(member) = IPAddress(static_cast<uint8_t>(part[0]), static_cast<uint8_t>(part[1]),
+                                                         static_cast<uint8_t>(part[2]), static_cast<uint8_t>(part[3]));
+            return true;
+        }
+        case FieldType::UInt: {
+            // strtoull skips white space and takes a sign, so check that the text starts with a digit
+            if (!isEmpty && !isdigit(static_cast<unsigned char>(*text))) return false;
+            char* numberEnd;
+            errno = 0;
+            const auto number = strtoull(text, &numberEnd, 10);
+            if (*numberEnd != 0 || errno == ERANGE || number > UINT_MAX) return false;
+            *static_cast<unsigned int*>(member) = static_cast<unsigned int>(number);
+            return true;
+        }
+        case FieldType::Bool: {
+            const bool isTrue = strcmp(text, "true") == 0 || strcmp(text, "1") == 0;
+            if (!isTrue && strcmp(text, "false") != 0 && strcmp(text, "0") != 0) return false;
+            *static_cast<bool*>(member) = isTrue;
+            return true;
+        }
+        case FieldType::String:
+        case FieldType::Certificate:
+            *static_cast<const char**>(member) = isEmpty ? nullptr : text;
+            return true;
+        case FieldType::Bssid: {
+            unsigned int part[BssidSize]{};
+            if (!isEmpty && sscanf(text, "%2x:%2x:%2x:%2x:%2x:%2x%c", &part[0], &part[1], &part[2], &part[3], &part[4], &part[5], &end) != BssidSize) {
+                return false;
+            }
+            for (size_t index = 0; index < BssidSize; index++) bssid[index] = static_cast<uint8_t>(part[index]);
+            *static_cast<const uint8_t**>(member) = isEmpty ? nullptr : bssid;
+            return true;
+        }
+        }
+        return false;
+    }
+
+    bool parseField(const uint8_t number, const char* text, void* member, uint8_t* bssid) {
+        if (!parseValue(BuiltInFields[number].type, text, member, bssid)) return false;
+        // the port of an endpoint is 16 bits
+        const auto& mqttSection = BuiltInSections[static_cast<uint8_t>(Section::Mqtt)];
+        return &BuiltInFields[number] != &mqttSection.fields[PortField] || *static_cast<const unsigned int*>(member) <= UINT16_MAX;
+    }
+
+    bool formatValue(const FieldType type, const void* member, char* text, const size_t size) {
+        int length = -1;
+        switch (type) {
+        case FieldType::Address: {
+            const auto& address = *static_cast<const IPAddress*>(member);
+            length = snprintf(text, size, "%u.%u.%u.%u", address[0], address[1], address[2], address[3]);
+            break;
+        }
+        case FieldType::UInt:
+            length = snprintf(text, size, "%u", *static_cast<const unsigned int*>(member));
+            break;
+        case FieldType::Bool:
+            length = snprintf(text, size, "%s", *static_cast<const bool*>(member) ? "true" : "false");
+            break;
+        case FieldType::String:
+        case FieldType::Certificate: {
+            const auto value = *static_cast<const char* const*>(member);
+            length = snprintf(text, size, "%s", value == nullptr ? "" : value);
+            break;
+        }
+        case FieldType::Bssid: {
+            const auto bssid = *static_cast<const uint8_t* const*>(member);
+            length = bssid == nullptr ? snprintf(text, size, "%s", "") :
+                snprintf(text, size, "%02x:%02x:%02x:%02x:%02x:%02x", bssid[0], bssid[1], bssid[2], bssid[3], bssid[4], bssid[5]);
+            break;
+        }
+        }
+        return length >= 0 && static_cast<size_t>(length) < size;
+    }
+}
@@ -0,0 +1,51 @@
+// Copyright 2024 Rik Essenius
+//
+// Licensed under the Apache License, Version 2.0 (the "License"); you may not use this file
+// except in compliance with the License. You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software distributed under the License
+// is distributed on an "AS IS" BASIS WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and limitations under the License.
+
+// Compile-time descriptions of configuration sections. One generic engine in Configuration loads, stores, compares,
+// copies and streams every section from these tables: the built-in ones and the ones an application adds.
+
+#ifndef HEADER_CONFIGURATION_SCHEMA
+#define HEADER_CONFIGURATION_SCHEMA
+
+#include <cstddef>
+#include <cstdint>
+
+namespace Esp32NetConfig {
+
+    // The type of the struct member and how it is stored
+    enum class FieldType : uint8_t {
+        Address,    // IPAddress, stored as a 32-bit number
+        UInt,       // unsigned int. 0 means "not set": the key is removed, so it loads as the default
+        Bool,       // bool
+        String,     // const char*, loaded into the buffer. nullptr removes the key
+        Bssid,      // const uint8_t* to 6 bytes, loaded into the buffer. nullptr removes the key
+        Certificate // const char* with PEM, stored as PEM, DER or in chunks. Only in the built-in TLS section
+    };
+
+    // For FieldDescriptor::defaultIfChangedField: the Bool is true by default if the UInt field at 'index' in the same
+    // section is not at its default
+    constexpr uint8_t defaultIfChanged(const uint8_t index) { return static_cast<uint8_t>(index + 1); }
+
+    struct FieldDescriptor {
+        const char* key;               // at most 15 characters
+        FieldType type;
+        uint16_t offset;               // of the member in the section's struct, e.g. offsetof(AppConfig, interval)
+        uint32_t defaultValue;         // for Address, UInt and Bool
+        uint8_t defaultIfChangedField; // for Bool: defaultIfChanged(index) to use instead of defaultValue, else 0
+    };
+
+    struct SectionDescriptor {
+        const char* name;      // the Preferences namespace, at most 15 characters
+        const FieldDescriptor* fields;
+        uint8_t fieldCount;
+    };
+}
+#endif
@@ -0,0 +1,449 @@
+// Copyright 2024 Rik Essenius
+//
+// Licensed under the Apache License, Version 2.0 (the "License"); you may not use this file
+// except in compliance with the License. You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software distributed under the License
+// is distributed on an "AS IS" BASIS WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and limitations under the License.
+
+// Streaming import and export of the configuration. See Configuration::Importer for the format.
+
+#include <algorithm>
+#include <cstring>
+#include <memory>
+#include "Configuration.h"
+#include "ConfigurationKeys.h"
+
+namespace Esp32NetConfig {
+
+    // The field number in the stream is the index in BuiltInFields, so only add fields at the end.
+    // Certificates can be longer than ChunkSize; they are stored in chunks if they are.
+    constexpr uint8_t StreamHeader[] = { 'N', 'C', 1 };
+    // Starts a section, so it is replaced even if it has no values. Importers that don't know it skip it like an unknown field.
+    constexpr uint8_t SectionField = 0xFE;
+    constexpr uint8_t EndField = 0xFF;
+    constexpr uint32_t BoolSize = 1;
+
+    // Importer
+
+    Configuration::Importer::Importer(const Configuration* configuration) : _configuration(configuration) {}
+
+    Configuration::Importer::~Importer() {
+        // an import that was abandoned leaves nothing staged
+        discardStaged();
+    }
+
+    void Configuration::Importer::commitPacked() {
+        // the staged sections are loaded like stored ones, into a buffer of their size, and put as one blob
+        const auto preferences = _configuration->_preferences.preferences;
+        Configuration sizer(preferences, nullptr, 0);
+        sizer._isDryRun = true;
+        loadStaged(sizer);
+        std::unique_ptr<char[]> buffer(new char[sizer._requiredSize]);
+        Configuration staged(preferences, buffer.get(), sizer._requiredSize);
+        loadStaged(staged);
+        const void* sections[SectionCount];
+        for (uint8_t section = 0; section < SectionCount; section++) {
+            sections[section] = (_importedSections & (1 << section)) != 0 ? staged.sectionData(static_cast<Section>(section)) : nullptr;
+        }
+        const auto written = _configuration->putPacked(
+            static_cast<const IpConfig*>(sections[0]), static_cast<const WifiConfig*>(sections[1]), static_cast<const TlsConfig*>(sections[2]),
+            static_cast<const MqttConfig*>(sections[3]), static_cast<const FirmwareConfig*>(sections[4]));
+        if (written == WriteFailed) _state = State::Failed;
+    }
+
+    void Configuration::Importer::commitPerKey(const uint8_t section) {
+        // replaces the stored section key by key through the window, so memory use stays fixed
+        const auto& preferences = _configuration->_preferences;
+        preferences->begin(SectionNamespaces[section], false);
+        const auto generation = preferences->getUInt(Generation, 0);
+        _configuration->clearSection(static_cast<Section>(section));
+        preferences->end();
+        const auto& descriptor = BuiltInSections[section];
+        for (uint8_t index = 0; index < descriptor.fieldCount; index++) {
+            const auto& field = descriptor.fields[index];
+            if (copyStaged(section, field.key, field.type) || field.type != FieldType::Certificate) continue;
+            char chunkKey[MaxKeyLength + 1];
+            for (unsigned int chunk = 0;; chunk++) {
+                toChunkKey(field.key, chunk, chunkKey);
+                if (!copyStaged(section, chunkKey, FieldType::String)) break;
+            }
+        }
+        preferences->begin(SectionNamespaces[section], false);
+        preferences->putUInt(Generation, generation + 1);
+        putEndpoint(static_cast<Section>(section));
+        preferences->end();
+    }
+
+    bool Configuration::Importer::copyStaged(const uint8_t section, const char* key, const FieldType type) {
+        // returns false if the key was not staged
+        const auto& preferences = _configuration->_preferences;
+        preferences->begin(ImportNamespaces[section], true);
+        const bool isStaged = preferences->isKey(key);
+        uint32_t number = 0;
+        if (isStaged) {
+            switch (type) {
+            case FieldType::Address:
+            case FieldType::UInt:
+                number = preferences->getUInt(key);
+                break;
+            case FieldType::Bool:
+                number = preferences->getBool(key) ? 1 : 0;
+                break;
+            case FieldType::Bssid:
+                preferences->getBytes(key, _window, BssidSize);
+                break;
+            case FieldType::String:
+            case FieldType::Certificate:
+                preferences->getString(key, _window, sizeof _window);
+                break;
+            }
+        }
+        preferences->end();
+        if (!isStaged) return false;
+        preferences->begin(SectionNamespaces[section], false);
+        switch (type) {
+        case FieldType::Address:
+        case FieldType::UInt:
+            preferences->putUInt(key, number);
+            break;
+        case FieldType::Bool:
+            preferences->putBool(key, number != 0);
+            break;
+        case FieldType::Bssid:
+            preferences->putBytes(key, _window, BssidSize);
+            break;
+        case FieldType::String:
+        case FieldType::Certificate:
+            preferences->putString(key, _window);
+            break;
+        }
+        preferences->end();
+        return true;
+    }
+
+    void Configuration::Importer::discardStaged() {
+        if (_importedSections == 0) return;
+        _configuration->waitForLoad();
+        const auto& preferences = _configuration->_preferences;
+        for (uint8_t section = 0; section < SectionCount; section++) {
+            if ((_importedSections & (1 << section)) == 0) continue;
+            preferences->begin(ImportNamespaces[section], false);
+            preferences->clear();
+            preferences->end();
+        }
+        _importedSections = 0;
+        _section = NoSection;
+    }
+
+    bool Configuration::Importer::fail() {
+        _state = State::Failed;
+        discardStaged();
+        return false;
+    }
+
+    bool Configuration::Importer::finish() {
+        _configuration->waitForLoad();
+        // nothing is stored unless the whole stream came in
+        if (_state == State::End && _importedSections != 0) {
+            if (_configuration->_storageMode == StorageMode::Packed) {
+                commitPacked();
+            }
+            else {
+                for (uint8_t section = 0; section < SectionCount; section++) {
+                    if ((_importedSections & (1 << section)) != 0) commitPerKey(section);
+                }
+            }
+        }
+        discardStaged();
+        return _state == State::End;
+    }
+
+    void Configuration::Importer::loadStaged(Configuration& staged) const {
+        for (uint8_t section = 0; section < SectionCount; section++) {
+            if ((_importedSections & (1 << section)) == 0) continue;
+            staged._preferences->begin(ImportNamespaces[section], true);
+            staged._next = staged.loadFields(BuiltInSections[section], staged.sectionData(static_cast<Section>(section)), staged._next);
+            staged._preferences->end();
+        }
+        _configuration->_preferences.operations += staged._preferences.operations;
+    }
+
+    void Configuration::Importer::selectSection(const uint8_t section) {
+        _section = section;
+        if ((_importedSections & (1 << section)) != 0) return;
+
+        // left over from an import that did not finish (e.g. a power loss)
+        const auto& preferences = _configuration->_preferences;
+        preferences->begin(ImportNamespaces[section], false);
+        preferences->clear();
+        preferences->end();
+        _importedSections |= 1 << section;
+    }
+
+    void Configuration::Importer::putEndpoint(const Section section) {
+        // the namespace is open; the endpoint is derived from the imported broker or URL, which fits the window
+        const auto& preferences = _configuration->_preferences;
+        if (section != Section::Mqtt && section != Section::Firmware) return;
+        const auto key = section == Section::Mqtt ? Broker : Url;
+        const auto source = preferences->isKey(key) && preferences->getString(key, _window, sizeof _window) > 0 ? _window : nullptr;
+        if (section == Section::Firmware) {
+            const FirmwareConfig firmwareConfig{ source };
+            _configuration->putEndpointOf(section, &firmwareConfig);
+            return;
+        }
+        // with the defaults of loadFields: TLS by default if the port is not the default
+        const auto port = preferences->getUInt(Port, DefaultMqttPort);
+        const MqttConfig mqttConfig{ source, port, nullptr, nullptr, preferences->getBool(UseTls, port != DefaultMqttPort) };
+        _configuration->putEndpointOf(section, &mqttConfig);
+    }
+
+    bool Configuration::Importer::startValue() {
+        _field = _header[0];
+        memcpy(&_remaining, _header + 1, sizeof _remaining);
+        _headerLength = 0;
+        _windowLength = 0;
+        _chunkIndex = 0;
+        if (_field == EndField) {
+            _state = State::End;
+            return true;
+        }
+        if (_field == SectionField) {
+            if (_remaining != 1) return fail();
+            _isKnownField = true;
+            _state = State::Value;
+            return true;
+        }
+        _isKnownField = _field < BuiltInFieldCount;
+        if (_isKnownField) {
+            switch (BuiltInFields[_field].type) {
+            case FieldType::Address:
+            case FieldType::UInt:
+                if (_remaining != sizeof(uint32_t)) return fail();
+                break;
+            case FieldType::Bool:
+                if (_remaining != BoolSize) return fail();
+                break;
+            case FieldType::Bssid:
+                if (_remaining != BssidSize) return fail();
+                break;
+            case FieldType::String:
+                if (_remaining > ChunkSize) return fail();
+                break;
+            case FieldType::Certificate:
+                break;
+            }
+            selectSection(sectionOf(_field));
+        }
+        _state = State::Value;
+        if (_remaining == 0) storeValue();
+        return true;
+    }
+
+    void Configuration::Importer::storeChunk() {
+        char chunkKey[MaxKeyLength + 1];
+        toChunkKey(BuiltInFields[_field].key, _chunkIndex++, chunkKey);
+        _window[_windowLength] = 0;
+        const auto& preferences = _configuration->_preferences;
+        preferences->begin(ImportNamespaces[_section], false);
+        preferences->putString(chunkKey, _window);
+        preferences->end();
+        _windowLength = 0;
+    }
+
+    void Configuration::Importer::storeValue() {
+        _state = State::RecordHeader;
+        if (!_isKnownField) return;
+        if (_field == SectionField) {
+            // a section of a newer version is skipped
+            if (static_cast<uint8_t>(_window[0]) < SectionCount) selectSection(static_cast<uint8_t>(_window[0]));
+            return;
+        }
+        const auto& field = BuiltInFields[_field];
+        // a chunked value that fit in one window is stored as a normal string
+        if (_chunkIndex > 0) {
+            if (_windowLength > 0) storeChunk();
+            return;
+        }
+        // the namespace is only open while storing, so the Configuration can be used between writes
+        const auto& preferences = _configuration->_preferences;
+        preferences->begin(ImportNamespaces[_section], false);
+        switch (field.type) {
+        case FieldType::Address:
+        case FieldType::UInt: {
+            uint32_t value;
+            memcpy(&value, _window, sizeof value);
+            preferences->putUInt(field.key, value);
+            break;
+        }
+        case FieldType::Bool:
+            preferences->putBool(field.key, _window[0] != 0);
+            break;
+        case FieldType::Bssid:
+            preferences->putBytes(field.key, _window, BssidSize);
+            break;
+        case FieldType::String:
+        case FieldType::Certificate:
+            _window[_windowLength] = 0;
+            preferences->putString(field.key, _window);
+            break;
+        }
+        preferences->end();
+    }
+
+    bool Configuration::Importer::write(const uint8_t* data, size_t size) {
+        _configuration->waitForLoad();
+        while (size > 0) {
+            switch (_state) {
+            case State::StreamHeader:
+                _header[_headerLength++] = *data++;
+                size--;
+                if (_headerLength < sizeof StreamHeader) break;
+                if (memcmp(_header, StreamHeader, sizeof StreamHeader) != 0) return fail();
+                _headerLength = 0;
+                _state = State::RecordHeader;
+                break;
+            case State::RecordHeader:
+                _header[_headerLength++] = *data++;
+                size--;
+                if (_headerLength == HeaderSize && !startValue()) return false;
+                break;
+            case State::Value: {
+                // fill the window, and store it as a chunk if it is full while more is coming
+                const auto count = std::min(std::min(static_cast<size_t>(_remaining), size), ChunkSize - _windowLength);
+                if (_isKnownField) memcpy(_window + _windowLength, data, count);
+                _windowLength += count;
+                _remaining -= static_cast<uint32_t>(count);
+                data += count;
+                size -= count;
+                if (_remaining == 0) {
+                    storeValue();
+                }
+                else if (_windowLength == ChunkSize) {
+                    if (_isKnownField) storeChunk();
+                    _windowLength = 0;
+                }
+                break;
+            }
+            case State::End:
+                // nothing may follow the end record
+            case State::Failed:
+                return fail();
+            }
+        }
+        return _state != State::Failed;
+    }
+
+    // Exporter
+
+    Configuration::Exporter::Exporter(Configuration* configuration) : _configuration(configuration) {
+        for (uint8_t section = 0; section < SectionCount; section++) {
+            if (!configuration->isLoaded(static_cast<Section>(section))) configuration->loadSection(static_cast<Section>(section));
+        }
+        // a value missing from a section would be removed by the import
+        _isValid = configuration->rebuildPem() && configuration->_truncatedSections == 0;
+    }
+
+    bool Configuration::Exporter::isValid() const {
+        return _isValid;
+    }
+
+    bool Configuration::Exporter::fieldValue(const uint8_t field) {
+        const auto& descriptor = BuiltInFields[field];
+        const auto member = static_cast<const char*>(_configuration->sectionData(static_cast<Section>(sectionOf(field)))) + descriptor.offset;
+        switch (descriptor.type) {
+        case FieldType::Address: {
+            const uint32_t number = *reinterpret_cast<const IPAddress*>(member);
+            memcpy(_number, &number, sizeof number);
+            _value = _number;
+            _valueLength = sizeof number;
+            return true;
+        }
+        case FieldType::UInt: {
+            const uint32_t number = *reinterpret_cast<const unsigned int*>(member);
+            memcpy(_number, &number, sizeof number);
+            _value = _number;
+            _valueLength = sizeof number;
+            return true;
+        }
+        case FieldType::Bool:
+            _number[0] = *reinterpret_cast<const bool*>(member) ? 1 : 0;
+            _value = _number;
+            _valueLength = BoolSize;
+            return true;
+        case FieldType::Bssid:
+            _value = *reinterpret_cast<const uint8_t* const*>(member);
+            _valueLength = BssidSize;
+            return _value != nullptr;
+        case FieldType::String:
+        case FieldType::Certificate:
+            break;
+        }
+        const auto text = *reinterpret_cast<const char* const*>(member);
+        if (text == nullptr) return false;
+        _value = reinterpret_cast<const uint8_t*>(text);
+        _valueLength = static_cast<uint32_t>(strlen(text));
+        return true;
+    }
+
+    bool Configuration::Exporter::nextRecord() {
+        if (_isEnded) return false;
+        _headerOffset = 0;
+        _valueOffset = 0;
+        _valueLength = 0;
+        if (!_isStarted) {
+            _isStarted = true;
+            memcpy(_header, StreamHeader, sizeof StreamHeader);
+            _headerLength = sizeof StreamHeader;
+            return true;
+        }
+        uint8_t field = EndField;
+        while (field == EndField && _nextField < BuiltInFieldCount) {
+            if (_nextSection < SectionCount && BuiltInSections[_nextSection].fields == BuiltInFields + _nextField) {
+                // every section starts with its own record, so an empty section is cleared on import too
+                _number[0] = _nextSection++;
+                _value = _number;
+                _valueLength = 1;
+                field = SectionField;
+            }
+            else if (fieldValue(_nextField++)) {
+                field = static_cast<uint8_t>(_nextField - 1);
+            }
+        }
+        if (field == EndField) {
+            _isEnded = true;
+            _valueLength = 0;
+        }
+        _header[0] = field;
+        memcpy(_header + 1, &_valueLength, sizeof _valueLength);
+        _headerLength = HeaderSize;
+        return true;
+    }
+
+    size_t Configuration::Exporter::read(uint8_t* buffer, const size_t size) {
+        _configuration->waitForLoad();
+        if (!_isValid) return 0;
+        size_t copied = 0;
+        while (copied < size) {
+            if (_headerOffset < _headerLength) {
+                const auto count = std::min(size - copied, _headerLength - _headerOffset);
+                memcpy(buffer + copied, _header + _headerOffset, count);
+                _headerOffset += count;
+                copied += count;
+            }
+            else if (_valueOffset < _valueLength) {
+                const auto count = std::min(size - copied, static_cast<size_t>(_valueLength - _valueOffset));
+                memcpy(buffer + copied, _value + _valueOffset, count);
+                _valueOffset += static_cast<uint32_t>(count);
+                copied += count;
+            }
+            else if (!nextRecord()) {
+                break;
+            }
+        }
+        return copied;
+    }
+}
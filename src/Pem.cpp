@@ -0,0 +1,157 @@
+// Copyright 2024 Rik Essenius
+// 
+// Licensed under the Apache License, Version 2.0 (the "License"); you may not use this file
+// except in compliance with the License. You may obtain a copy of the License at
+// 
+//     http://www.apache.org/licenses/LICENSE-2.0
+// 
+// Unless required by applicable law or agreed to in writing, software distributed under the License
+// is distributed on an "AS IS" BASIS WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and limitations under the License.
+
+#include <cstdio>
+#include <cstring>
+#include "Pem.h"
+
+namespace Esp32NetConfig {
+
+    constexpr auto BeginPrefix = "-----BEGIN ";
+    constexpr auto EndPrefix = "-----END ";
+    constexpr auto Dashes = "-----";
+    constexpr size_t LineLength = 64;
+    constexpr auto Base64Characters = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+    bool Pem::isWhitespace(const char character) {
+        return character == ' ' || character == '\t' || character == '\r' || character == '\n';
+    }
+
+    const char* Pem::skipWhitespace(const char* text) {
+        while (isWhitespace(*text)) text++;
+        return text;
+    }
+
+    int Pem::base64Value(const char character) {
+        if (character >= 'A' && character <= 'Z') return character - 'A';
+        if (character >= 'a' && character <= 'z') return character - 'a' + 26;
+        if (character >= '0' && character <= '9') return character - '0' + 52;
+        if (character == '+') return 62;
+        if (character == '/') return 63;
+        return -1;
+    }
+
+    // Decodes base64 up to the next '-'. Whitespace is ignored; anything else (like PEM headers) fails.
+    const char* Pem::decodeBase64(const char* text, std::vector<uint8_t>& der) {
+        uint32_t accumulator = 0;
+        int bits = 0;
+        bool isPadding = false;
+        for (; *text != '-'; text++) {
+            if (*text == 0) return nullptr;
+            if (isWhitespace(*text)) continue;
+            if (*text == '=') {
+                isPadding = true;
+                continue;
+            }
+            const auto value = base64Value(*text);
+            if (value < 0 || isPadding) return nullptr;
+            accumulator = (accumulator << 6) | static_cast<uint32_t>(value);
+            bits += 6;
+            if (bits >= 8) {
+                bits -= 8;
+                der.push_back(static_cast<uint8_t>(accumulator >> bits));
+                accumulator &= (1u << bits) - 1;
+            }
+        }
+        return text;
+    }
+
+    size_t Pem::base64Length(const size_t size) {
+        const auto characters = (size + 2) / 3 * 4;
+        return characters + (characters + LineLength - 1) / LineLength;
+    }
+
+    size_t Pem::objectLength(const uint8_t* der, const size_t derLength) {
+        // an ASN.1 object: tag, length (short form, or long form with up to 3 bytes), content
+        if (derLength < 2) return derLength;
+        size_t headerLength = 2;
+        size_t contentLength = der[1];
+        if (contentLength & 0x80) {
+            const size_t lengthBytes = contentLength & 0x7f;
+            if (lengthBytes == 0 || lengthBytes > 3 || derLength < 2 + lengthBytes) return derLength;
+            contentLength = 0;
+            for (size_t i = 0; i < lengthBytes; i++) {
+                contentLength = (contentLength << 8) | der[2 + i];
+            }
+            headerLength += lengthBytes;
+        }
+        const auto length = headerLength + contentLength;
+        return length > derLength ? derLength : length;
+    }
+
+    size_t Pem::pemLength(const char* label, const uint8_t* der, const size_t derLength) {
+        const auto labelLength = strlen(label);
+        const auto frameLength = strlen(BeginPrefix) + strlen(EndPrefix) + 2 * (labelLength + strlen(Dashes) + 1);
+        size_t length = 1;
+        for (size_t offset = 0; offset < derLength;) {
+            const auto size = objectLength(der + offset, derLength - offset);
+            length += frameLength + base64Length(size);
+            offset += size;
+        }
+        return length;
+    }
+
+    bool Pem::toDer(const char* pem, std::string& label, std::vector<uint8_t>& der) {
+        label.clear();
+        der.clear();
+        const auto beginLength = strlen(BeginPrefix);
+        const auto endLength = strlen(EndPrefix);
+        const auto dashesLength = strlen(Dashes);
+        auto text = skipWhitespace(pem);
+        while (*text != 0) {
+            if (strncmp(text, BeginPrefix, beginLength) != 0) return false;
+            text += beginLength;
+            const auto labelEnd = strstr(text, Dashes);
+            if (labelEnd == nullptr) return false;
+            const std::string blockLabel(text, labelEnd);
+            if (label.empty()) {
+                label = blockLabel;
+            }
+            else if (label != blockLabel) return false;
+            text = decodeBase64(labelEnd + dashesLength, der);
+            if (text == nullptr || strncmp(text, EndPrefix, endLength) != 0) return false;
+            text += endLength;
+            if (strncmp(text, label.c_str(), label.size()) != 0 || strncmp(text + label.size(), Dashes, dashesLength) != 0) return false;
+            text = skipWhitespace(text + label.size() + dashesLength);
+        }
+        return !label.empty() && !der.empty();
+    }
+
+    size_t Pem::toPem(const char* label, const uint8_t* der, const size_t derLength, char* buffer, const size_t bufferSize) {
+        const auto length = pemLength(label, der, derLength);
+        if (length > bufferSize) return 0;
+        auto output = buffer;
+        for (size_t offset = 0; offset < derLength;) {
+            const auto size = objectLength(der + offset, derLength - offset);
+            output += sprintf(output, "%s%s%s\n", BeginPrefix, label, Dashes);
+            size_t lineCharacters = 0;
+            for (size_t i = 0; i < size; i += 3) {
+                const auto remaining = size - i;
+                const uint32_t block = static_cast<uint32_t>(der[offset + i]) << 16 |
+                    (remaining > 1 ? static_cast<uint32_t>(der[offset + i + 1]) << 8 : 0) |
+                    (remaining > 2 ? der[offset + i + 2] : 0);
+                for (int j = 0; j < 4; j++) {
+                    *output++ = j <= static_cast<int>(remaining) ? Base64Characters[(block >> (18 - 6 * j)) & 0x3f] : '=';
+                }
+                lineCharacters += 4;
+                if (lineCharacters == LineLength) {
+                    *output++ = '\n';
+                    lineCharacters = 0;
+                }
+            }
+            if (lineCharacters > 0) *output++ = '\n';
+            output += sprintf(output, "%s%s%s\n", EndPrefix, label, Dashes);
+            offset += size;
+        }
+        *output++ = 0;
+        return static_cast<size_t>(output - buffer);
+    }
+}
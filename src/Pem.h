@@ -0,0 +1,41 @@
+// Copyright 2024 Rik Essenius
+// 
+// Licensed under the Apache License, Version 2.0 (the "License"); you may not use this file
+// except in compliance with the License. You may obtain a copy of the License at
+// 
+//     http://www.apache.org/licenses/LICENSE-2.0
+// 
+// Unless required by applicable law or agreed to in writing, software distributed under the License
+// is distributed on an "AS IS" BASIS WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and limitations under the License.
+
+// Converts between PEM text and DER. A PEM text can hold several blocks (e.g. a certificate chain); 
+// they must have the same label, and map to the concatenation of their DER objects.
+
+#ifndef HEADER_PEM
+#define HEADER_PEM
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace Esp32NetConfig {
+    class Pem {
+    public:
+        // Returns false (e.g. for encrypted PEM with headers, or mixed labels) if the text can't be represented as DER.
+        static bool toDer(const char* pem, std::string& label, std::vector<uint8_t>& der);
+        // The number of characters toPem needs, including the terminator
+        static size_t pemLength(const char* label, const uint8_t* der, size_t derLength);
+        // Writes the PEM text. Returns the number of characters written including the terminator, or 0 if it doesn't fit.
+        static size_t toPem(const char* label, const uint8_t* der, size_t derLength, char* buffer, size_t bufferSize);
+    private:
+        static size_t base64Length(size_t size);
+        static int base64Value(char character);
+        static const char* decodeBase64(const char* text, std::vector<uint8_t>& der);
+        static bool isWhitespace(char character);
+        static size_t objectLength(const uint8_t* der, size_t derLength);
+        static const char* skipWhitespace(const char* text);
+    };
+}
+#endif
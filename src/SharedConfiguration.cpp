@@ -0,0 +1,90 @@
+// Copyright 2024 Rik Essenius
+//
+// Licensed under the Apache License, Version 2.0 (the "License"); you may not use this file
+// except in compliance with the License. You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software distributed under the License
+// is distributed on an "AS IS" BASIS WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and limitations under the License.
+
+#include <thread>
+#include "SharedConfiguration.h"
+
+namespace Esp32NetConfig {
+
+    SharedConfiguration::SharedConfiguration(Preferences* preferences, const StorageMode storageMode) :
+        _first(preferences, storageMode), _second(preferences, storageMode), _slot{ &_first, &_second } {
+        _readers[0].store(0);
+        _readers[1].store(0);
+    }
+
+    SharedConfiguration::SharedConfiguration(Preferences* preferences, char* buffer, const size_t bufferSize, const StorageMode storageMode) :
+        _first(preferences, buffer, bufferSize / 2, storageMode),
+        _second(preferences, buffer + bufferSize / 2, bufferSize / 2, storageMode),
+        _slot{ &_first, &_second } {
+        _readers[0].store(0);
+        _readers[1].store(0);
+    }
+
+    // All operations on _readers and _current are sequentially consistent. A reader announces itself on a slot and then
+    // checks that the slot is still current; reload() switches the current slot and then checks the readers of the
+    // slot it is going to load. So either reload() sees the reader and waits, or the reader sees the switch and retries.
+    uint8_t SharedConfiguration::acquire() const {
+        while (true) {
+            const uint8_t slot = _current.load();
+            _readers[slot].fetch_add(1);
+            if (_current.load() == slot) return slot;
+            _readers[slot].fetch_sub(1);
+        }
+    }
+
+    void SharedConfiguration::release(const uint8_t slot) const {
+        _readers[slot].fetch_sub(1);
+    }
+
+    void SharedConfiguration::reload() {
+        std::lock_guard<std::mutex> lock(_reloadMutex);
+        const uint8_t current = _current.load();
+        const uint8_t spare = 1 - current;
+        while (_readers[spare].load() != 0) {
+            std::this_thread::yield();
+        }
+        _slot[spare]->begin();
+        // make sure the PEM view of DER entries is in the buffer, since readers can't build it
+        _slot[spare]->tlsConfig();
+        _slotVersion[spare] = _slotVersion[current] + 1;
+        _current.store(spare);
+    }
+
+    SharedConfiguration::Snapshot SharedConfiguration::snapshot() const {
+        return { this, acquire() };
+    }
+
+    uint32_t SharedConfiguration::version() const {
+        return snapshot().version();
+    }
+
+    SharedConfiguration::Snapshot::Snapshot(const SharedConfiguration* owner, const uint8_t slot) : _owner(owner), _slot(slot) {}
+
+    SharedConfiguration::Snapshot::Snapshot(Snapshot&& other) noexcept : _owner(other._owner), _slot(other._slot) {
+        other._owner = nullptr;
+    }
+
+    SharedConfiguration::Snapshot::~Snapshot() {
+        if (_owner != nullptr) _owner->release(_slot);
+    }
+
+    const Configuration& SharedConfiguration::Snapshot::operator*() const {
+        return *_owner->_slot[_slot];
+    }
+
+    const Configuration* SharedConfiguration::Snapshot::operator->() const {
+        return _owner->_slot[_slot];
+    }
+
+    uint32_t SharedConfiguration::Snapshot::version() const {
+        return _owner->_slotVersion[_slot];
+    }
+}
@@ -0,0 +1,72 @@
+// Copyright 2024 Rik Essenius
+//
+// Licensed under the Apache License, Version 2.0 (the "License"); you may not use this file
+// except in compliance with the License. You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software distributed under the License
+// is distributed on an "AS IS" BASIS WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and limitations under the License.
+
+// Shares a loaded configuration between tasks. Readers take a snapshot without locking; reload() loads into
+// the other of two Configuration objects and then switches to it, so a snapshot never sees a half-loaded buffer.
+
+#ifndef HEADER_SHARED_CONFIGURATION
+#define HEADER_SHARED_CONFIGURATION
+
+#include <atomic>
+#include <mutex>
+#include "Configuration.h"
+
+namespace Esp32NetConfig {
+    class SharedConfiguration {
+    public:
+        // Keeps the configuration it points to unchanged while it exists. Release it soon: reload() can only
+        // reuse the buffer once all snapshots older than the current one are gone.
+        class Snapshot {
+        public:
+            Snapshot(Snapshot&& other) noexcept;
+            Snapshot(const Snapshot&) = delete;
+            Snapshot& operator=(const Snapshot&) = delete;
+            Snapshot& operator=(Snapshot&&) = delete;
+            ~Snapshot();
+            const Configuration& operator*() const;
+            const Configuration* operator->() const;
+            // The number of reloads done before this configuration was loaded
+            uint32_t version() const;
+        private:
+            friend class SharedConfiguration;
+            Snapshot(const SharedConfiguration* owner, uint8_t slot);
+            const SharedConfiguration* _owner;
+            uint8_t _slot;
+        };
+
+        // Nothing is loaded until the first reload().
+        // Uses two buffers of Configuration::DefaultBufferSize bytes on the heap.
+        explicit SharedConfiguration(Preferences* preferences, StorageMode storageMode = StorageMode::PerKey);
+        // Splits the caller's buffer in two halves, one per Configuration. It must outlive the SharedConfiguration.
+        SharedConfiguration(Preferences* preferences, char* buffer, size_t bufferSize, StorageMode storageMode = StorageMode::PerKey);
+        SharedConfiguration(const SharedConfiguration&) = delete;
+        SharedConfiguration& operator=(const SharedConfiguration&) = delete;
+
+        // Lock-free: never waits for reload(). It only retries if a reload switched buffers while it was starting.
+        Snapshot snapshot() const;
+        // Loads all sections (including the PEM view of DER entries) into the buffer not in use, and then switches to it.
+        // Waits until the snapshots still using that buffer are released. Reloads are serialized; readers are not affected.
+        void reload();
+        uint32_t version() const;
+    private:
+        static constexpr uint8_t SlotCount = 2;
+        Configuration _first;
+        Configuration _second;
+        Configuration* _slot[SlotCount];
+        uint32_t _slotVersion[SlotCount] = { 0, 0 };
+        mutable std::atomic<uint32_t> _readers[SlotCount]; // snapshots per slot, including ones still checking _current
+        std::atomic<uint8_t> _current{ 0 };
+        std::mutex _reloadMutex;
+        uint8_t acquire() const;
+        void release(uint8_t slot) const;
+    };
+}
+#endif
@@ -0,0 +1,63 @@
+// Copyright 2024 Rik Essenius
+// 
+// Licensed under the Apache License, Version 2.0 (the "License"); you may not use this file
+// except in compliance with the License. You may obtain a copy of the License at
+// 
+//     http://www.apache.org/licenses/LICENSE-2.0
+// 
+// Unless required by applicable law or agreed to in writing, software distributed under the License
+// is distributed on an "AS IS" BASIS WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and limitations under the License.
+
+#include <atomic>
+#include <cstdlib>
+#include <new>
+#include "AllocationCounter.h"
+
+namespace {
+    std::atomic<bool> isCounting(false);
+    std::atomic<size_t> allocations(0);
+}
+
+namespace Esp32NetConfigCppTest {
+    void AllocationCounter::start() {
+        allocations = 0;
+        isCounting = true;
+    }
+
+    size_t AllocationCounter::stop() {
+        isCounting = false;
+        return allocations;
+    }
+
+    size_t AllocationCounter::count() {
+        return allocations;
+    }
+}
+
+void* operator new(const size_t size) {
+    if (isCounting) ++allocations;
+    if (const auto pointer = std::malloc(size == 0 ? 1 : size)) return pointer;
+    throw std::bad_alloc();
+}
+
+void* operator new[](const size_t size) {
+    return operator new(size);
+}
+
+void operator delete(void* pointer) noexcept {
+    std::free(pointer);
+}
+
+void operator delete[](void* pointer) noexcept {
+    std::free(pointer);
+}
+
+// the sized forms, which the compiler may call instead when it knows the size
+void operator delete(void* pointer, size_t) noexcept {
+    std::free(pointer);
+}
+
+void operator delete[](void* pointer, size_t) noexcept {
+    std::free(pointer);
+}
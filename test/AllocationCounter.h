@@ -0,0 +1,27 @@
+// Copyright 2024 Rik Essenius
+// 
+// Licensed under the Apache License, Version 2.0 (the "License"); you may not use this file
+// except in compliance with the License. You may obtain a copy of the License at
+// 
+//     http://www.apache.org/licenses/LICENSE-2.0
+// 
+// Unless required by applicable law or agreed to in writing, software distributed under the License
+// is distributed on an "AS IS" BASIS WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and limitations under the License.
+
+// Test hook counting heap allocations. It replaces the global operator new, and only counts between start() and stop().
+
+#ifndef HEADER_ALLOCATION_COUNTER
+#define HEADER_ALLOCATION_COUNTER
+
+#include <cstddef>
+
+namespace Esp32NetConfigCppTest {
+    class AllocationCounter {
+    public:
+        static void start();
+        static size_t stop();
+        static size_t count();
+    };
+}
+#endif
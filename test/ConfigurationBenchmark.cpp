@@ -0,0 +1,342 @@
+// Copyright 2024 Rik Essenius
+// 
+// Licensed under the Apache License, Version 2.0 (the "License"); you may not use this file
+// except in compliance with the License. You may obtain a copy of the License at
+// 
+//     http://www.apache.org/licenses/LICENSE-2.0
+// 
+// Unless required by applicable law or agreed to in writing, software distributed under the License
+// is distributed on an "AS IS" BASIS WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and limitations under the License.
+
+// Benchmarks for loading and storing the configuration. Besides the time, each benchmark reports the NVS operations
+// per iteration as counted by the instrumented Preferences stand-in, and the heap allocations.
+// The argument is the scenario: 0 = nothing stored, 1 = no TLS, 2 = single certificates, 3 = full certificate chains.
+// The put benchmarks start at 1, as they always have something to put. putChanged puts in one transaction, and
+// putChangedSeparately puts the same values with a call per section, to compare the time and the writes.
+// The boot benchmarks simulate NVS lookup time and other boot work, to show what beginAsync() overlaps. Both busy-wait,
+// so the overlap depends on a second core being free, as on a dual-core ESP32; on a single-core chip there is none.
+// The image generation benchmark writes images for a manifest of devices into a temporary folder; its argument is the
+// number of threads.
+
+#include <chrono>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+#include <benchmark/benchmark.h>
+#include <Preferences.h>
+#include "Configuration.h"
+#include "AllocationCounter.h"
+#include "ImageGenerator.h"
+#include "Manifest.h"
+#include "TemporaryFolder.h"
+
+namespace Esp32NetConfigCppTest {
+    using Esp32NetConfig::Configuration;
+    using Esp32NetConfig::FirmwareConfig;
+    using Esp32NetConfig::ImageGenerator;
+    using Esp32NetConfig::IpConfig;
+    using Esp32NetConfig::Manifest;
+    using Esp32NetConfig::LoadMode;
+    using Esp32NetConfig::MqttConfig;
+    using Esp32NetConfig::Section;
+    using Esp32NetConfig::StorageMode;
+    using Esp32NetConfig::TlsConfig;
+    using Esp32NetConfig::WifiConfig;
+
+    constexpr int ScenarioCount = 4;
+
+    // A PEM-like text of about the given size, so the sizes are realistic
+    std::string pem(const char* label, const size_t size) {
+        std::string result = std::string("-----BEGIN ") + label + "-----\n";
+        while (result.size() < size) {
+            result += std::string(64, 'M') + "\n";
+        }
+        return result + "-----END " + label + "-----\n";
+    }
+
+    struct Scenario {
+        std::string rootCa;
+        std::string deviceCertificate;
+        std::string deviceKey;
+        bool useTls;
+
+        explicit Scenario(const int index) : useTls(index >= 2) {
+            if (!useTls) return;
+            const auto chainLength = index == 3 ? 3 : 1;
+            for (int i = 0; i < chainLength; i++) {
+                rootCa += pem("CERTIFICATE", 1300);
+            }
+            deviceCertificate = pem("CERTIFICATE", 1200);
+            deviceKey = pem("RSA PRIVATE KEY", 1700);
+        }
+
+        // Puts the scenario's configuration. The password differs per variant, so we can force changes.
+        // Without a transaction, every section is put by its own call.
+        void put(const Configuration& configuration, const int variant = 0, const bool isTransaction = true) const {
+            const char* passwords[] = { "password", "Password" };
+            const WifiConfig wifi{ "ssid", passwords[variant], "deviceName", nullptr };
+            const IpConfig ip{ {192, 168, 1, 10}, {192, 168, 1, 1}, {255, 255, 255, 0}, {192, 168, 1, 1}, {8, 8, 8, 8} };
+            const TlsConfig tls{ rootCa.c_str(), deviceCertificate.c_str(), deviceKey.c_str() };
+            const MqttConfig mqtt{ "broker.local", useTls ? 8883u : 1883u, "user", passwords[variant], useTls };
+            const FirmwareConfig firmware{ "http://firmware.local/device" };
+            if (!isTransaction) {
+                configuration.putWifiConfig(&wifi);
+                configuration.putIpConfig(&ip);
+                configuration.putMqttConfig(&mqtt);
+                configuration.putFirmwareConfig(&firmware);
+                if (useTls) configuration.putTlsConfig(&tls);
+                return;
+            }
+            auto transaction = configuration.beginTransaction();
+            transaction.putWifiConfig(&wifi).putIpConfig(&ip).putMqttConfig(&mqtt).putFirmwareConfig(&firmware);
+            if (useTls) {
+                transaction.putTlsConfig(&tls);
+            }
+            transaction.commit();
+        }
+    };
+
+    void prepare(const int scenario, const StorageMode storageMode) {
+        Preferences::reset();
+        Preferences preferences;
+        if (scenario == 0) return;
+        const Configuration configuration(&preferences, storageMode);
+        Scenario(scenario).put(configuration);
+    }
+
+    void report(benchmark::State& state, const PreferencesCounters& counters, const size_t allocations) {
+        using benchmark::Counter;
+        state.counters["namespaceOpens"] = Counter(static_cast<double>(counters.namespaceOpens), Counter::kAvgIterations);
+        state.counters["keyLookups"] = Counter(static_cast<double>(counters.keyLookups), Counter::kAvgIterations);
+        state.counters["writes"] = Counter(static_cast<double>(counters.writes), Counter::kAvgIterations);
+        state.counters["bytesRead"] = Counter(static_cast<double>(counters.bytesRead), Counter::kAvgIterations);
+        state.counters["bytesWritten"] = Counter(static_cast<double>(counters.bytesWritten), Counter::kAvgIterations);
+        state.counters["allocations"] = Counter(static_cast<double>(allocations), Counter::kAvgIterations);
+    }
+
+    void begin(benchmark::State& state, const StorageMode storageMode, const LoadMode loadMode) {
+        const auto scenario = static_cast<int>(state.range(0));
+        prepare(scenario, storageMode);
+        Preferences preferences;
+        const auto bufferSize = Configuration::requiredBufferSize(&preferences, storageMode);
+        std::unique_ptr<char[]> buffer(new char[bufferSize + 1]);
+        Configuration configuration(&preferences, buffer.get(), bufferSize + 1, storageMode);
+        Preferences::resetCounters();
+        AllocationCounter::start();
+        for (auto _ : state) {
+            configuration.begin(loadMode);
+            // in lazy mode, this is what a typical application touches
+            benchmark::DoNotOptimize(configuration.wifiConfig().ssid);
+            benchmark::DoNotOptimize(configuration.tlsConfig().rootCaCertificate);
+        }
+        report(state, Preferences::counters(), AllocationCounter::stop());
+        state.counters["bufferBytes"] = static_cast<double>(bufferSize + 1 - configuration.freeBufferSpace());
+    }
+
+    void beginPerKey(benchmark::State& state) {
+        begin(state, StorageMode::PerKey, LoadMode::Eager);
+    }
+
+    void beginPerKeyLazy(benchmark::State& state) {
+        begin(state, StorageMode::PerKey, LoadMode::Lazy);
+    }
+
+    void beginPacked(benchmark::State& state) {
+        begin(state, StorageMode::Packed, LoadMode::Eager);
+    }
+
+    void requiredBufferSize(benchmark::State& state) {
+        prepare(static_cast<int>(state.range(0)), StorageMode::PerKey);
+        Preferences preferences;
+        Preferences::resetCounters();
+        AllocationCounter::start();
+        for (auto _ : state) {
+            benchmark::DoNotOptimize(Configuration::requiredBufferSize(&preferences));
+        }
+        report(state, Preferences::counters(), AllocationCounter::stop());
+    }
+
+    // Alternates between two variants, so every iteration has changes to write
+    void putChanged(benchmark::State& state, const StorageMode storageMode, const bool isTransaction = true) {
+        const auto scenario = static_cast<int>(state.range(0));
+        prepare(scenario, storageMode);
+        const Scenario data(scenario);
+        Preferences preferences;
+        const Configuration configuration(&preferences, storageMode);
+        Preferences::resetCounters();
+        AllocationCounter::start();
+        auto variant = 0;
+        for (auto _ : state) {
+            variant = 1 - variant;
+            data.put(configuration, variant, isTransaction);
+        }
+        report(state, Preferences::counters(), AllocationCounter::stop());
+    }
+
+    void putChangedPerKey(benchmark::State& state) {
+        putChanged(state, StorageMode::PerKey);
+    }
+
+    void putChangedPacked(benchmark::State& state) {
+        putChanged(state, StorageMode::Packed);
+    }
+
+    // The same values as putChanged, but put section by section instead of in one transaction
+    void putChangedSeparatelyPerKey(benchmark::State& state) {
+        putChanged(state, StorageMode::PerKey, false);
+    }
+
+    void putChangedSeparatelyPacked(benchmark::State& state) {
+        putChanged(state, StorageMode::Packed, false);
+    }
+
+    // Re-applies the stored configuration, which should not write anything
+    void putUnchanged(benchmark::State& state, const StorageMode storageMode) {
+        const auto scenario = static_cast<int>(state.range(0));
+        prepare(scenario, storageMode);
+        const Scenario data(scenario);
+        Preferences preferences;
+        const Configuration configuration(&preferences, storageMode);
+        Preferences::resetCounters();
+        AllocationCounter::start();
+        for (auto _ : state) {
+            data.put(configuration);
+        }
+        report(state, Preferences::counters(), AllocationCounter::stop());
+    }
+
+    void putUnchangedPerKey(benchmark::State& state) {
+        putUnchanged(state, StorageMode::PerKey);
+    }
+
+    void putUnchangedPacked(benchmark::State& state) {
+        putUnchanged(state, StorageMode::Packed);
+    }
+
+    // Changes the Wi-Fi password, by name or by putting the section with the new password
+    void changeField(benchmark::State& state, const bool isByName) {
+        const auto scenario = static_cast<int>(state.range(0));
+        prepare(scenario, StorageMode::PerKey);
+        Preferences preferences;
+        Configuration configuration(&preferences);
+        configuration.begin();
+        WifiConfig wifi = configuration.wifi;
+        Preferences::resetCounters();
+        AllocationCounter::start();
+        auto variant = 0;
+        for (auto _ : state) {
+            variant = 1 - variant;
+            const auto password = variant == 0 ? "password0" : "password1";
+            if (isByName) {
+                configuration.set("wifi.password", password);
+            }
+            else {
+                wifi.password = password;
+                configuration.putWifiConfig(&wifi);
+            }
+        }
+        report(state, Preferences::counters(), AllocationCounter::stop());
+    }
+
+    void setField(benchmark::State& state) {
+        changeField(state, true);
+    }
+
+    void putFieldSection(benchmark::State& state) {
+        changeField(state, false);
+    }
+
+    // Roughly what a key lookup in NVS takes on an ESP32
+    constexpr unsigned int LookupMicros = 20;
+    // Boot work that does not need the configuration, e.g. sensor initialization
+    constexpr auto OtherBootWork = std::chrono::milliseconds(2);
+
+    // Keeps the CPU busy, like the boot work would
+    void doOtherBootWork() {
+        const auto end = std::chrono::steady_clock::now() + OtherBootWork;
+        while (std::chrono::steady_clock::now() < end) {}
+    }
+
+    std::string coresLabel() {
+        return "busy-waiting, cores: " + std::to_string(std::thread::hardware_concurrency());
+    }
+
+    // Boot until Wi-Fi can start and everything is loaded, with begin() first and then the other work
+    void bootSequential(benchmark::State& state) {
+        const auto scenario = static_cast<int>(state.range(0));
+        prepare(scenario, StorageMode::PerKey);
+        Preferences preferences;
+        Configuration configuration(&preferences);
+        Preferences::setLookupDelay(LookupMicros);
+        for (auto _ : state) {
+            configuration.begin();
+            doOtherBootWork();
+            benchmark::DoNotOptimize(configuration.wifi.ssid);
+        }
+        Preferences::setLookupDelay(0);
+        state.SetLabel(coresLabel());
+    }
+
+    // The same with beginAsync(): the other work runs while the sections load
+    void bootOverlapped(benchmark::State& state) {
+        const auto scenario = static_cast<int>(state.range(0));
+        prepare(scenario, StorageMode::PerKey);
+        Preferences preferences;
+        Configuration configuration(&preferences);
+        Preferences::setLookupDelay(LookupMicros);
+        for (auto _ : state) {
+            configuration.beginAsync();
+            doOtherBootWork();
+            configuration.waitForSection(Section::Wifi);
+            benchmark::DoNotOptimize(configuration.wifi.ssid);
+            configuration.waitForLoad();
+        }
+        Preferences::setLookupDelay(0);
+        state.SetLabel(coresLabel());
+    }
+
+    constexpr size_t ManifestDevices = 1000;
+    constexpr size_t PartitionSize = 16384;
+
+    // A production run: every device has its own credentials and a single certificate set
+    void generateImages(benchmark::State& state) {
+        const Scenario data(2);
+        std::string csv = "id,wifi.ssid,wifi.password,mqtt.broker,mqtt.port,mqtt.user,mqtt.password,mqtt.useTls,"
+                          "tls.rootCaCert,tls.deviceCert,tls.deviceKey,firmware.url\n";
+        for (size_t i = 0; i < ManifestDevices; i++) {
+            const auto n = std::to_string(i);
+            csv += "board" + n + ",ssid,password" + n + ",broker.local,8883,device" + n + ",secret" + n + ",true,\"" +
+                data.rootCa + "\",\"" + data.deviceCertificate + "\",\"" + data.deviceKey + "\",http://firmware.local\n";
+        }
+        Manifest manifest;
+        manifest.parseCsv(csv);
+        const ImageGenerator generator(PartitionSize);
+        const TemporaryFolder folder;
+        std::vector<std::string> errors;
+        for (auto _ : state) {
+            benchmark::DoNotOptimize(generator.generate(manifest, folder.path(), static_cast<unsigned int>(state.range(0)), errors));
+        }
+        state.SetItemsProcessed(static_cast<int64_t>(state.iterations() * ManifestDevices));
+        state.SetBytesProcessed(static_cast<int64_t>(state.iterations() * ManifestDevices * PartitionSize));
+    }
+
+    BENCHMARK(beginPerKey)->DenseRange(0, ScenarioCount - 1);
+    BENCHMARK(beginPerKeyLazy)->DenseRange(0, ScenarioCount - 1);
+    BENCHMARK(beginPacked)->DenseRange(0, ScenarioCount - 1);
+    BENCHMARK(requiredBufferSize)->DenseRange(0, ScenarioCount - 1);
+    BENCHMARK(putChangedPerKey)->DenseRange(1, ScenarioCount - 1);
+    BENCHMARK(putChangedPacked)->DenseRange(1, ScenarioCount - 1);
+    BENCHMARK(putChangedSeparatelyPerKey)->DenseRange(1, ScenarioCount - 1);
+    BENCHMARK(putChangedSeparatelyPacked)->DenseRange(1, ScenarioCount - 1);
+    BENCHMARK(putUnchangedPerKey)->DenseRange(1, ScenarioCount - 1);
+    BENCHMARK(putUnchangedPacked)->DenseRange(1, ScenarioCount - 1);
+    BENCHMARK(setField)->DenseRange(1, ScenarioCount - 1);
+    BENCHMARK(putFieldSection)->DenseRange(1, ScenarioCount - 1);
+    BENCHMARK(bootSequential)->DenseRange(1, ScenarioCount - 1)->UseRealTime();
+    BENCHMARK(bootOverlapped)->DenseRange(1, ScenarioCount - 1)->UseRealTime();
+    BENCHMARK(generateImages)->RangeMultiplier(2)->Range(1, 8)->UseRealTime()->Unit(benchmark::kMillisecond);
+}
+
+BENCHMARK_MAIN();
@@ -0,0 +1,187 @@
+// Copyright 2024 Rik Essenius
+//
+// Licensed under the Apache License, Version 2.0 (the "License"); you may not use this file
+// except in compliance with the License. You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software distributed under the License
+// is distributed on an "AS IS" BASIS WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and limitations under the License.
+
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <Preferences.h>
+#include "Configuration.h"
+#include "ConfigurationImage.h"
+#include "TemporaryFolder.h"
+#include "gtest/gtest.h"
+
+namespace Esp32NetConfigCppTest {
+    using Esp32NetConfig::Configuration;
+    using Esp32NetConfig::ConfigurationImage;
+    using Esp32NetConfig::FirmwareConfig;
+    using Esp32NetConfig::IpConfig;
+    using Esp32NetConfig::LoadMode;
+    using Esp32NetConfig::MqttConfig;
+    using Esp32NetConfig::Section;
+    using Esp32NetConfig::StorageMode;
+    using Esp32NetConfig::TlsConfig;
+    using Esp32NetConfig::WifiConfig;
+
+    // Returns the path of the image
+    std::string writeImage(Preferences& preferences, const TemporaryFolder& folder) {
+        const std::string chain = "-----BEGIN CERTIFICATE-----\n" + std::string(3000, 'A') + "\n-----END CERTIFICATE-----\n";
+        const TlsConfig configTls{ chain.c_str(), "deviceCert", "deviceKey" };
+        constexpr MqttConfig ConfigMqtt{ "factoryBroker", 8883, "user", "password", true };
+        uint8_t bssid[] = { 1, 2, 3, 4, 5, 6 };
+        const WifiConfig configWifi{ "ssid", "password", "deviceName", bssid };
+        constexpr FirmwareConfig ConfigFirmware{ "http://localhost/firmware" };
+        const IpConfig configIp{ 0x0101A8C0, 0x0101A8C0, 0x00FFFFFF, 0x08080808, 0x04040808 };
+        preferences.reset();
+        Configuration source(&preferences);
+        source.beginTransaction().putIpConfig(&configIp).putWifiConfig(&configWifi).putTlsConfig(&configTls)
+            .putMqttConfig(&ConfigMqtt).putFirmwareConfig(&ConfigFirmware).commit();
+        std::vector<uint8_t> image;
+        source.buildImage(image);
+        const auto imagePath = folder.file("ConfigurationImageTest.bin");
+        const auto file = fopen(imagePath.c_str(), "wb");
+        fwrite(image.data(), 1, image.size(), file);
+        fclose(file);
+        preferences.reset();
+        return imagePath;
+    }
+
+    bool isIn(const ConfigurationImage& image, const void* value) {
+        const auto pointer = static_cast<const char*>(value);
+        return pointer >= image.data() && pointer < image.data() + image.size();
+    }
+
+    TEST(ConfigurationImageTest, zeroCopyTest) {
+        Preferences preferences;
+        const TemporaryFolder folder;
+        const auto imagePath = writeImage(preferences, folder);
+        const ConfigurationImage image(imagePath.c_str());
+        ASSERT_TRUE(image.isMapped()) << "Image mapped";
+        char buffer[100];
+        Configuration configuration(&preferences, buffer, sizeof buffer);
+        configuration.attachImage(&image);
+        configuration.begin();
+        EXPECT_EQ(static_cast<int>(sizeof buffer), configuration.freeBufferSpace()) << "Nothing copied into the buffer";
+        EXPECT_EQ(3000u + 55u, strlen(configuration.tls.rootCaCertificate)) << "Large certificate loaded";
+        EXPECT_TRUE(isIn(image, configuration.tls.rootCaCertificate)) << "Certificate in the image";
+        EXPECT_TRUE(isIn(image, configuration.mqtt.broker)) << "Broker in the image";
+        EXPECT_STREQ("factoryBroker", configuration.mqtt.broker) << "Broker";
+        EXPECT_EQ(8883u, configuration.mqtt.port) << "Port";
+        EXPECT_TRUE(configuration.mqtt.useTls) << "Use TLS";
+        EXPECT_STREQ("deviceName", configuration.wifi.deviceName) << "Device name";
+        EXPECT_EQ(6, configuration.wifi.bssid[5]) << "BSSID";
+        EXPECT_TRUE(isIn(image, configuration.wifi.bssid)) << "BSSID in the image";
+        EXPECT_EQ(0x04040808u, static_cast<uint32_t>(configuration.ip.secondaryDns)) << "Secondary DNS";
+        EXPECT_STREQ("http://localhost/firmware", configuration.firmware.baseUrl) << "Firmware URL";
+        EXPECT_EQ(0u, Configuration::requiredBufferSize(&preferences)) << "Nothing in Preferences";
+    }
+
+    TEST(ConfigurationImageTest, overlayTest) {
+        Preferences preferences;
+        const TemporaryFolder folder;
+        const auto imagePath = writeImage(preferences, folder);
+        const ConfigurationImage image(imagePath.c_str());
+        Configuration configuration(&preferences);
+        configuration.attachImage(&image);
+        configuration.begin();
+        constexpr MqttConfig ConfigMqtt{ "newBroker", 0, nullptr, nullptr, false };
+        EXPECT_EQ(2u, configuration.putMqttConfig(&ConfigMqtt)) << "Broker and TLS flag written over the image";
+        EXPECT_EQ(1u, configuration.reload()) << "MQTT reloaded";
+        EXPECT_STREQ("newBroker", configuration.mqtt.broker) << "Broker from Preferences";
+        EXPECT_FALSE(isIn(image, configuration.mqtt.broker)) << "Broker in the buffer";
+        EXPECT_EQ(1883u, configuration.mqtt.port) << "Put section does not fall back to the image";
+        EXPECT_EQ(nullptr, configuration.mqtt.user) << "No user in the put section";
+        EXPECT_TRUE(isIn(image, configuration.tls.deviceCertificate)) << "TLS still from the image";
+
+        constexpr FirmwareConfig NoFirmware{ nullptr };
+        EXPECT_EQ(0u, configuration.putFirmwareConfig(&NoFirmware)) << "No keys written";
+        Configuration lazy(&preferences);
+        lazy.attachImage(&image);
+        lazy.begin(LoadMode::Lazy);
+        EXPECT_EQ(nullptr, lazy.firmwareConfig().baseUrl) << "Empty section put over the image";
+        EXPECT_STREQ("newBroker", lazy.mqttConfig().broker) << "Lazy load from Preferences";
+        EXPECT_STREQ("ssid", lazy.wifiConfig().ssid) << "Lazy load from the image";
+    }
+
+    TEST(ConfigurationImageTest, resolvedAddressTest) {
+        Preferences preferences;
+        const TemporaryFolder folder;
+        const auto imagePath = writeImage(preferences, folder);
+        const ConfigurationImage image(imagePath.c_str());
+        Configuration configuration(&preferences);
+        configuration.attachImage(&image);
+        configuration.begin();
+        const IPAddress address(192, 168, 1, 10);
+        EXPECT_EQ(1u, configuration.putResolvedAddress(Section::Mqtt, address, 3600)) << "Endpoint record created for the image section";
+        EXPECT_EQ(0u, configuration.putResolvedAddress(Section::Mqtt, address, 3600)) << "Same address not written";
+        EXPECT_EQ(1u, configuration.putResolvedAddress(Section::Firmware, address, 7200)) << "Firmware endpoint record created";
+        configuration.begin();
+        EXPECT_TRUE(isIn(image, configuration.mqtt.broker)) << "MQTT still from the image";
+        EXPECT_STREQ("factoryBroker", configuration.mqttEndpoint.host) << "MQTT host";
+        EXPECT_EQ(8883u, configuration.mqttEndpoint.port) << "MQTT port";
+        EXPECT_EQ(address, configuration.mqttEndpoint.address) << "MQTT address cached";
+        EXPECT_EQ(3600u, configuration.mqttEndpoint.addressExpiry) << "MQTT expiry cached";
+        EXPECT_STREQ("localhost", configuration.firmwareEndpoint.host) << "Firmware host";
+        EXPECT_EQ(address, configuration.firmwareEndpoint.address) << "Firmware address cached";
+        EXPECT_EQ(7200u, configuration.firmwareEndpoint.addressExpiry) << "Firmware expiry cached";
+    }
+
+    TEST(ConfigurationImageTest, setTest) {
+        Preferences preferences;
+        const TemporaryFolder folder;
+        const auto imagePath = writeImage(preferences, folder);
+        const ConfigurationImage image(imagePath.c_str());
+        Configuration configuration(&preferences);
+        configuration.attachImage(&image);
+        configuration.begin();
+        EXPECT_TRUE(configuration.set("mqtt.port", "8884")) << "Set port over the image";
+        EXPECT_EQ(1u, configuration.reload()) << "MQTT reloaded";
+        EXPECT_FALSE(isIn(image, configuration.mqtt.broker)) << "Section now in Preferences";
+        EXPECT_STREQ("factoryBroker", configuration.mqtt.broker) << "Broker taken from the image";
+        EXPECT_STREQ("user", configuration.mqtt.user) << "User taken from the image";
+        EXPECT_EQ(8884u, configuration.mqtt.port) << "Port set";
+        EXPECT_TRUE(configuration.mqtt.useTls) << "TLS taken from the image";
+        EXPECT_STREQ("factoryBroker", configuration.mqttEndpoint.host) << "Endpoint host";
+        EXPECT_EQ(8884u, configuration.mqttEndpoint.port) << "Endpoint port";
+        EXPECT_TRUE(isIn(image, configuration.wifi.ssid)) << "Wi-Fi still from the image";
+    }
+
+    TEST(ConfigurationImageTest, noImageTest) {
+        Preferences preferences;
+        preferences.reset();
+        const ConfigurationImage missing("missing.bin");
+        EXPECT_FALSE(missing.isMapped()) << "Missing file not mapped";
+        EXPECT_EQ(nullptr, missing.data()) << "No data";
+        EXPECT_EQ(0u, missing.size()) << "No size";
+
+        constexpr MqttConfig ConfigMqtt{ "broker", 1883, "user", "password", false };
+        Configuration configuration(&preferences);
+        configuration.putMqttConfig(&ConfigMqtt);
+        configuration.attachImage(&missing);
+        configuration.begin();
+        EXPECT_STREQ("broker", configuration.mqtt.broker) << "Put section loaded";
+        EXPECT_EQ(nullptr, configuration.wifi.ssid) << "Nothing for the other sections";
+
+        // a packed blob takes precedence over the image
+        const TemporaryFolder folder;
+        const auto imagePath = writeImage(preferences, folder);
+        const ConfigurationImage image(imagePath.c_str());
+        Configuration packed(&preferences, StorageMode::Packed);
+        packed.attachImage(&image);
+        packed.begin();
+        EXPECT_STREQ("factoryBroker", packed.mqtt.broker) << "No blob, so from the image";
+        packed.putMqttConfig(&ConfigMqtt);
+        packed.begin();
+        EXPECT_STREQ("broker", packed.mqtt.broker) << "From the blob";
+        EXPECT_STREQ("ssid", packed.wifi.ssid) << "The blob includes what came from the image";
+        EXPECT_EQ(1u, packed.generation(Section::Mqtt)) << "Blob written";
+    }
+}
@@ -0,0 +1,134 @@
+// Copyright 2024 Rik Essenius
+//
+// Licensed under the Apache License, Version 2.0 (the "License"); you may not use this file
+// except in compliance with the License. You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software distributed under the License
+// is distributed on an "AS IS" BASIS WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and limitations under the License.
+
+#include <string>
+#include <Preferences.h>
+#include "Configuration.h"
+#include "ConfigurationKeys.h"
+#include "gtest/gtest.h"
+
+namespace Esp32NetConfigCppTest {
+    using Esp32NetConfig::BuiltInFieldCount;
+    using Esp32NetConfig::BuiltInFields;
+    using Esp32NetConfig::BuiltInSections;
+    using Esp32NetConfig::Configuration;
+    using Esp32NetConfig::FieldDescriptor;
+    using Esp32NetConfig::FieldType;
+    using Esp32NetConfig::MqttConfig;
+    using Esp32NetConfig::SectionCount;
+    using Esp32NetConfig::SectionDescriptor;
+    using Esp32NetConfig::StorageMode;
+
+    struct SensorConfig {
+        const char* topic;
+        unsigned int interval;
+        bool isEnabled;
+        const uint8_t* bssid;
+    };
+
+    constexpr FieldDescriptor SensorFields[] = {
+        { "topic", FieldType::String, offsetof(SensorConfig, topic), 0, 0 },
+        { "interval", FieldType::UInt, offsetof(SensorConfig, interval), 60, 0 },
+        { "enabled", FieldType::Bool, offsetof(SensorConfig, isEnabled), 0, Esp32NetConfig::defaultIfChanged(1) },
+        { "bssid", FieldType::Bssid, offsetof(SensorConfig, bssid), 0, 0 }
+    };
+    constexpr SectionDescriptor SensorSection{ "sensor", SensorFields, 4 };
+
+    TEST(ConfigurationSchemaTest, userSectionTest) {
+        uint8_t bssid[] = { 1, 2, 3, 4, 5, 6 };
+        const SensorConfig configSensor{ "sensors/kitchen", 30, false, bssid };
+        Preferences preferences;
+        preferences.reset();
+        char buffer[100];
+        Configuration configuration(&preferences, buffer, sizeof buffer);
+        SensorConfig sensor{};
+        EXPECT_TRUE(configuration.addSection(&SensorSection, &sensor)) << "Section added";
+        configuration.begin();
+        EXPECT_EQ(nullptr, sensor.topic) << "No topic yet";
+        EXPECT_EQ(60u, sensor.interval) << "Default interval";
+        EXPECT_FALSE(sensor.isEnabled) << "Interval at its default, so not enabled";
+        EXPECT_EQ(nullptr, sensor.bssid) << "No BSSID yet";
+
+        EXPECT_EQ(4u, configuration.putSection(&SensorSection, &configSensor)) << "All fields written";
+        EXPECT_EQ(0u, configuration.putSection(&SensorSection, &configSensor)) << "Nothing changed, so nothing written";
+        configuration.begin();
+        EXPECT_STREQ("sensors/kitchen", sensor.topic) << "Topic loaded";
+        EXPECT_EQ(30u, sensor.interval) << "Interval loaded";
+        EXPECT_FALSE(sensor.isEnabled) << "Stored value overrides the derived default";
+        EXPECT_EQ(0, memcmp(bssid, sensor.bssid, sizeof bssid)) << "BSSID loaded";
+        EXPECT_EQ(buffer, sensor.topic) << "Topic in the configuration's buffer";
+        EXPECT_EQ(static_cast<int>(sizeof buffer - 16 - sizeof bssid), configuration.freeBufferSpace()) << "Topic and BSSID take buffer space";
+
+        const SensorConfig defaults{ nullptr, 0, true, nullptr };
+        EXPECT_EQ(4u, configuration.putSection(&SensorSection, &defaults)) << "Keys removed and flag written";
+        configuration.begin();
+        EXPECT_EQ(nullptr, sensor.topic) << "Topic removed";
+        EXPECT_EQ(60u, sensor.interval) << "Interval back at default";
+        EXPECT_TRUE(sensor.isEnabled) << "Enabled";
+        EXPECT_EQ(nullptr, sensor.bssid) << "BSSID removed";
+
+        EXPECT_FALSE(configuration.addSection(nullptr, &sensor)) << "No descriptor";
+        EXPECT_FALSE(configuration.addSection(&SensorSection, nullptr)) << "No data";
+        EXPECT_EQ(0u, configuration.putSection(&SensorSection, nullptr)) << "Nothing to put";
+    }
+
+    TEST(ConfigurationSchemaTest, maxUserSectionsTest) {
+        Preferences preferences;
+        preferences.reset();
+        Configuration configuration(&preferences);
+        SensorConfig sensors[Configuration::MaxUserSections + 1]{};
+        for (uint8_t i = 0; i < Configuration::MaxUserSections; i++) {
+            EXPECT_TRUE(configuration.addSection(&SensorSection, &sensors[i])) << "Section " << static_cast<int>(i) << " added";
+        }
+        EXPECT_FALSE(configuration.addSection(&SensorSection, &sensors[Configuration::MaxUserSections])) << "No room for more";
+
+        const SensorConfig configSensor{ "topic", 10, true, nullptr };
+        configuration.putSection(&SensorSection, &configSensor);
+        configuration.begin();
+        for (uint8_t i = 0; i < Configuration::MaxUserSections; i++) {
+            EXPECT_STREQ("topic", sensors[i].topic) << "Section " << static_cast<int>(i) << " loaded";
+        }
+        EXPECT_STREQ(nullptr, sensors[Configuration::MaxUserSections].topic) << "Rejected section not loaded";
+    }
+
+    TEST(ConfigurationSchemaTest, packedUserSectionTest) {
+        constexpr MqttConfig ConfigMqtt{ "broker", 8883, "user", "password", true };
+        const SensorConfig configSensor{ "sensors/hall", 5, true, nullptr };
+        Preferences preferences;
+        preferences.reset();
+        Configuration configuration(&preferences, StorageMode::Packed);
+        SensorConfig sensor{};
+        configuration.addSection(&SensorSection, &sensor);
+        configuration.putMqttConfig(&ConfigMqtt);
+        EXPECT_EQ(3u, configuration.putSection(&SensorSection, &configSensor)) << "User sections are stored per key";
+        configuration.begin();
+        EXPECT_EQ(1u, configuration.generation()) << "Built-in sections from the blob";
+        EXPECT_STREQ("broker", configuration.mqtt.broker) << "Broker loaded";
+        EXPECT_STREQ("sensors/hall", sensor.topic) << "User section loaded after the blob";
+        EXPECT_EQ(5u, sensor.interval) << "Interval loaded";
+    }
+
+    TEST(ConfigurationSchemaTest, findFieldTest) {
+        for (uint8_t section = 0; section < SectionCount; section++) {
+            const auto& descriptor = BuiltInSections[section];
+            for (uint8_t index = 0; index < descriptor.fieldCount; index++) {
+                const auto name = std::string(descriptor.name) + "." + descriptor.fields[index].key;
+                const auto number = static_cast<uint8_t>(descriptor.fields + index - BuiltInFields);
+                EXPECT_EQ(number, Esp32NetConfig::findField(name.c_str())) << name << " found";
+                EXPECT_EQ(section, Esp32NetConfig::sectionOf(number)) << name << " section";
+            }
+        }
+        for (const auto name : { "mqtt", "mqtt.", "mqtt.portx", "mqtt.por", "mqttport", "wifi.port", ".port", "" }) {
+            EXPECT_EQ(BuiltInFieldCount, Esp32NetConfig::findField(name)) << name << " not found";
+        }
+        EXPECT_EQ(BuiltInFieldCount, Esp32NetConfig::findField(nullptr)) << "nullptr not found";
+    }
+}
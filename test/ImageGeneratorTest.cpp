@@ -0,0 +1,138 @@
+// Copyright 2024 Rik Essenius
+//
+// Licensed under the Apache License, Version 2.0 (the "License"); you may not use this file
+// except in compliance with the License. You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software distributed under the License
+// is distributed on an "AS IS" BASIS WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and limitations under the License.
+
+#include <cstdio>
+#include <string>
+#include <vector>
+#include <Preferences.h>
+#include "Configuration.h"
+#include "ConfigurationImage.h"
+#include "ImageGenerator.h"
+#include "Manifest.h"
+#include "TemporaryFolder.h"
+#include "gtest/gtest.h"
+
+namespace Esp32NetConfigCppTest {
+    using Esp32NetConfig::Configuration;
+    using Esp32NetConfig::ConfigurationImage;
+    using Esp32NetConfig::ImageGenerator;
+    using Esp32NetConfig::Manifest;
+
+    TEST(ImageGeneratorTest, csvTest) {
+        Manifest manifest;
+        EXPECT_TRUE(manifest.parseCsv("id,wifi.ssid,mqtt.password\r\n"
+                                      "board1,\"ssid, with comma\",\"pass\"\"word\"\r\n"
+                                      "\n"
+                                      "board2,\"two\nlines\",\n")) << "Parsed";
+        ASSERT_EQ(2u, manifest.devices().size()) << "Empty line skipped";
+        EXPECT_EQ("ssid, with comma", manifest.devices()[0].at("wifi.ssid")) << "Comma in quotes";
+        EXPECT_EQ("pass\"word", manifest.devices()[0].at("mqtt.password")) << "Doubled quote";
+        EXPECT_EQ("two\nlines", manifest.devices()[1].at("wifi.ssid")) << "Line break in quotes";
+        EXPECT_EQ("", manifest.devices()[1].at("mqtt.password")) << "Empty last field";
+
+        EXPECT_FALSE(manifest.parseCsv("id,wifi.ssid\nboard1\n")) << "Too few fields";
+        EXPECT_EQ("line 2: expected 2 fields", manifest.error()) << "Error reported";
+        EXPECT_FALSE(manifest.parseCsv("id\n\"board1\n")) << "Unterminated quote";
+        EXPECT_FALSE(manifest.parseCsv("")) << "No header";
+    }
+
+    TEST(ImageGeneratorTest, jsonTest) {
+        Manifest manifest;
+        EXPECT_TRUE(manifest.parseJson(R"([ { "id": "board1", "mqtt.port": 8883, "mqtt.useTls": true, "wifi.ssid": "caf\u00e9\n" },
+                                            { "id": "board2", "mqtt.user": null } ])")) << "Parsed";
+        ASSERT_EQ(2u, manifest.devices().size()) << "Two devices";
+        EXPECT_EQ("8883", manifest.devices()[0].at("mqtt.port")) << "Number as text";
+        EXPECT_EQ("true", manifest.devices()[0].at("mqtt.useTls")) << "Boolean as text";
+        EXPECT_EQ("caf\xC3\xA9\n", manifest.devices()[0].at("wifi.ssid")) << "Escapes";
+        EXPECT_EQ("", manifest.devices()[1].at("mqtt.user")) << "Null is empty";
+        EXPECT_TRUE(manifest.parseJson("[]")) << "Empty array";
+        EXPECT_FALSE(manifest.parseJson("{}")) << "Not an array";
+        EXPECT_FALSE(manifest.parseJson(R"([ { "id" "board1" } ])")) << "Missing colon";
+        EXPECT_EQ("offset 9: expected ':'", manifest.error()) << "Error reported";
+    }
+
+    TEST(ImageGeneratorTest, buildTest) {
+        const std::string certificate = "-----BEGIN CERTIFICATE-----\nMIIB\n-----END CERTIFICATE-----\n";
+        const TemporaryFolder folder;
+        const auto certificateFile = fopen(folder.file("ImageGeneratorTest.pem").c_str(), "wb");
+        fwrite(certificate.data(), 1, certificate.size(), certificateFile);
+        fclose(certificateFile);
+
+        Manifest manifest;
+        EXPECT_TRUE(manifest.parseCsv("id,wifi.ssid,wifi.password,wifi.bssid,ip.local,mqtt.broker,mqtt.port,mqtt.useTls,tls.rootCaCert,firmware.url\n"
+                                      "board1,ssid1,secret,01:02:03:04:05:a6,192.168.1.10,broker1,8883,true,@ImageGeneratorTest.pem,http://fw\n"
+                                      "board2,ssid2,,,,broker2,,,,\n")) << "Parsed";
+        const ImageGenerator generator(4096, folder.path());
+        std::vector<std::string> errors;
+        EXPECT_EQ(2u, generator.generate(manifest, folder.path(), 2, errors)) << "Two images written";
+        EXPECT_TRUE(errors.empty()) << "No errors";
+
+        Preferences preferences;
+        preferences.reset();
+        const ConfigurationImage image(folder.file("board1.bin").c_str());
+        ASSERT_TRUE(image.isMapped()) << "Image written";
+        EXPECT_EQ(4096u, image.size()) << "Padded to the partition size";
+        Configuration configuration(&preferences);
+        configuration.attachImage(&image);
+        configuration.begin();
+        EXPECT_STREQ("ssid1", configuration.wifi.ssid) << "SSID";
+        EXPECT_STREQ("secret", configuration.wifi.password) << "Password";
+        EXPECT_EQ(0xA6, configuration.wifi.bssid[5]) << "BSSID";
+        EXPECT_EQ(IPAddress(192, 168, 1, 10), configuration.ip.localIp) << "Local IP";
+        EXPECT_EQ(8883u, configuration.mqtt.port) << "Port";
+        EXPECT_TRUE(configuration.mqtt.useTls) << "Use TLS";
+        EXPECT_EQ(certificate, configuration.tls.rootCaCertificate) << "Certificate from file";
+        EXPECT_STREQ("http://fw", configuration.firmware.baseUrl) << "Firmware URL";
+
+        const ConfigurationImage second(folder.file("board2.bin").c_str());
+        Configuration other(&preferences);
+        other.attachImage(&second);
+        other.begin();
+        EXPECT_STREQ("broker2", other.mqtt.broker) << "Second broker";
+        EXPECT_EQ(1883u, other.mqtt.port) << "Default port";
+        EXPECT_EQ(nullptr, other.wifi.password) << "Empty value not set";
+    }
+
+    TEST(ImageGeneratorTest, invalidValuesTest) {
+        const ImageGenerator generator(128);
+        std::vector<uint8_t> image;
+        std::string error;
+        EXPECT_FALSE(generator.build({ { "wifi.unknown", "x" } }, image, error)) << "Unknown key";
+        EXPECT_EQ("unknown column wifi.unknown", error) << "Unknown key reported";
+        EXPECT_FALSE(generator.build({ { "ssid", "x" } }, image, error)) << "No namespace";
+        EXPECT_FALSE(generator.build({ { "ip.local", "1.2.3.256" } }, image, error)) << "Invalid address";
+        EXPECT_FALSE(generator.build({ { "mqtt.port", "-1" } }, image, error)) << "Invalid port";
+        EXPECT_FALSE(generator.build({ { "mqtt.port", " 1883" } }, image, error)) << "Leading white space";
+        EXPECT_FALSE(generator.build({ { "mqtt.port", "70000" } }, image, error)) << "Port out of range";
+        EXPECT_FALSE(generator.build({ { "mqtt.port", "4294967296" } }, image, error)) << "Number out of range";
+        EXPECT_FALSE(generator.build({ { "mqtt.useTls", "yes" } }, image, error)) << "Invalid boolean";
+        EXPECT_FALSE(generator.build({ { "wifi.bssid", "01:02:03" } }, image, error)) << "Invalid BSSID";
+        EXPECT_FALSE(generator.build({ { "tls.rootCaCert", "@missing.pem" } }, image, error)) << "Missing file";
+        EXPECT_FALSE(generator.build({ { "wifi.ssid", std::string(100, 's') } }, image, error)) << "Too large for the partition";
+        EXPECT_TRUE(generator.build({ { "wifi.ssid", "ssid" } }, image, error)) << "Fits";
+
+        const TemporaryFolder folder;
+        Manifest manifest;
+        manifest.parseCsv("wifi.ssid\nssid\n");
+        std::vector<std::string> errors;
+        EXPECT_EQ(0u, generator.generate(manifest, folder.path(), 1, errors)) << "Nothing written";
+        ASSERT_EQ(1u, errors.size()) << "One error";
+        EXPECT_EQ("device 1: no id", errors[0]) << "No id reported";
+
+        manifest.parseCsv("id,wifi.ssid\n../board1,ssid\nsub/board2,ssid\nsub\\board3,ssid\n..,ssid\nboard..5,ssid\n");
+        errors.clear();
+        EXPECT_EQ(0u, generator.generate(manifest, folder.path(), 1, errors)) << "Nothing written outside the folder";
+        ASSERT_EQ(5u, errors.size()) << "All ids rejected";
+        EXPECT_EQ("device 1: invalid id ../board1", errors[0]) << "Parent folder reported";
+        EXPECT_EQ("device 2: invalid id sub/board2", errors[1]) << "Separator reported";
+        EXPECT_EQ("device 3: invalid id sub\\board3", errors[2]) << "Windows separator reported";
+    }
+}
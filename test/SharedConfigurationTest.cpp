@@ -0,0 +1,155 @@
+// Copyright 2024 Rik Essenius
+//
+// Licensed under the Apache License, Version 2.0 (the "License"); you may not use this file
+// except in compliance with the License. You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software distributed under the License
+// is distributed on an "AS IS" BASIS WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and limitations under the License.
+
+#include <atomic>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+#include <Preferences.h>
+#include "SharedConfiguration.h"
+#include "gtest/gtest.h"
+
+namespace Esp32NetConfigCppTest {
+    using Esp32NetConfig::Configuration;
+    using Esp32NetConfig::FirmwareConfig;
+    using Esp32NetConfig::MqttConfig;
+    using Esp32NetConfig::SharedConfiguration;
+    using Esp32NetConfig::TlsConfig;
+    using Esp32NetConfig::WifiConfig;
+
+    // Writes a configuration in which every field contains the number n.
+    void putNumbered(const Configuration& writer, const unsigned int n) {
+        const auto suffix = std::to_string(n);
+        const auto broker = "broker-" + suffix;
+        const auto ssid = "ssid-" + suffix;
+        const auto rootCa = "rootCa-" + suffix;
+        const auto url = "http://firmware-" + suffix;
+        const MqttConfig mqtt{ broker.c_str(), n, "user", "password", true };
+        const WifiConfig wifi{ ssid.c_str(), "password", "device", nullptr };
+        const TlsConfig tls{ rootCa.c_str(), nullptr, nullptr };
+        const FirmwareConfig firmware{ url.c_str() };
+        writer.beginTransaction().putMqttConfig(&mqtt).putWifiConfig(&wifi).putTlsConfig(&tls).putFirmwareConfig(&firmware).commit();
+    }
+
+    unsigned long numberIn(const char* value) {
+        if (value == nullptr) return 0;
+        return strtoul(strrchr(value, '-') + 1, nullptr, 10);
+    }
+
+    TEST(SharedConfigurationTest, snapshotTest) {
+        Preferences preferences;
+        preferences.reset();
+        Configuration writer(&preferences);
+        char buffer[400];
+        SharedConfiguration shared(&preferences, buffer, sizeof buffer);
+        {
+            const auto snapshot = shared.snapshot();
+            EXPECT_EQ(0u, snapshot.version()) << "Nothing loaded yet";
+            EXPECT_EQ(nullptr, snapshot->mqtt.broker) << "No broker yet";
+        }
+        putNumbered(writer, 1);
+        shared.reload();
+        const auto first = shared.snapshot();
+        EXPECT_EQ(1u, first.version()) << "Version 1 after first reload";
+        EXPECT_STREQ("broker-1", first->mqtt.broker) << "Broker loaded";
+        EXPECT_STREQ("rootCa-1", (*first).tls.rootCaCertificate) << "Root CA loaded";
+
+        putNumbered(writer, 2);
+        shared.reload();
+        const auto second = shared.snapshot();
+        EXPECT_EQ(2u, second.version()) << "Version 2 after second reload";
+        EXPECT_STREQ("broker-2", second->mqtt.broker) << "New broker in new snapshot";
+        EXPECT_STREQ("broker-1", first->mqtt.broker) << "Old snapshot unchanged";
+        EXPECT_EQ(2u, shared.version()) << "Shared version is the current one";
+    }
+
+    TEST(SharedConfigurationTest, readersDontWaitForReloadTest) {
+        Preferences preferences;
+        preferences.reset();
+        Configuration writer(&preferences);
+        SharedConfiguration shared(&preferences);
+        putNumbered(writer, 1);
+        shared.reload();
+        auto old = std::unique_ptr<SharedConfiguration::Snapshot>(new SharedConfiguration::Snapshot(shared.snapshot()));
+        putNumbered(writer, 2);
+        shared.reload();
+
+        // the next reload needs the buffer the old snapshot is using, so it has to wait for that
+        putNumbered(writer, 3);
+        std::atomic<bool> reloaded{ false };
+        std::thread reloader([&shared, &reloaded] {
+            shared.reload();
+            reloaded = true;
+        });
+        for (int i = 0; i < 1000; i++) {
+            const auto snapshot = shared.snapshot();
+            EXPECT_STREQ("broker-2", snapshot->mqtt.broker) << "Readers get the current snapshot during the reload";
+        }
+        EXPECT_FALSE(reloaded) << "Reload waits for the old snapshot";
+        EXPECT_STREQ("broker-1", (*old)->mqtt.broker) << "Old snapshot still intact";
+        old.reset();
+        reloader.join();
+        EXPECT_TRUE(reloaded) << "Reload done after old snapshot released";
+        EXPECT_STREQ("broker-3", shared.snapshot()->mqtt.broker) << "Reloaded";
+    }
+
+    TEST(SharedConfigurationTest, stressTest) {
+        constexpr unsigned int Reloads = 100;
+        constexpr int ReaderCount = 4;
+        Preferences preferences;
+        preferences.reset();
+        Configuration writer(&preferences);
+        SharedConfiguration shared(&preferences);
+        putNumbered(writer, 1);
+        shared.reload();
+
+        std::atomic<bool> done{ false };
+        std::atomic<unsigned int> mixed{ 0 };
+        std::atomic<unsigned int> backwards{ 0 };
+        std::vector<unsigned long> snapshotCount(ReaderCount, 0);
+        std::vector<std::thread> readers;
+        for (int i = 0; i < ReaderCount; i++) {
+            readers.emplace_back([&shared, &done, &mixed, &backwards, &snapshotCount, i] {
+                uint32_t lastVersion = 0;
+                while (!done) {
+                    const auto snapshot = shared.snapshot();
+                    const auto version = snapshot.version();
+                    if (version < lastVersion) ++backwards;
+                    lastVersion = version;
+                    if (numberIn(snapshot->mqtt.broker) != version ||
+                        snapshot->mqtt.port != version ||
+                        numberIn(snapshot->wifi.ssid) != version ||
+                        numberIn(snapshot->tls.rootCaCertificate) != version ||
+                        numberIn(snapshot->firmware.baseUrl) != version) {
+                        ++mixed;
+                    }
+                    snapshotCount[i]++;
+                }
+            });
+        }
+        for (unsigned int n = 2; n <= Reloads; n++) {
+            putNumbered(writer, n);
+            shared.reload();
+        }
+        done = true;
+        for (auto& reader : readers) reader.join();
+
+        EXPECT_EQ(0u, mixed) << "No snapshot mixed data of different reloads";
+        EXPECT_EQ(0u, backwards) << "Versions never went back";
+        EXPECT_EQ(Reloads, shared.version()) << "All reloads done";
+        for (int i = 0; i < ReaderCount; i++) {
+            EXPECT_LT(0u, snapshotCount[i]) << "Reader " << i << " took snapshots";
+        }
+    }
+}
@@ -0,0 +1,78 @@
+// Copyright 2024 Rik Essenius
+// 
+// Licensed under the Apache License, Version 2.0 (the "License"); you may not use this file
+// except in compliance with the License. You may obtain a copy of the License at
+// 
+//     http://www.apache.org/licenses/LICENSE-2.0
+// 
+// Unless required by applicable law or agreed to in writing, software distributed under the License
+// is distributed on an "AS IS" BASIS WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and limitations under the License.
+
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+#include "TemporaryFolder.h"
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <dirent.h>
+#include <unistd.h>
+#endif
+
+namespace Esp32NetConfigCppTest {
+
+#ifdef _WIN32
+    TemporaryFolder::TemporaryFolder() {
+        char folder[MAX_PATH];
+        char name[MAX_PATH];
+        GetTempPathA(MAX_PATH, folder);
+        // GetTempFileName creates a file with a unique name; the folder takes its place
+        GetTempFileNameA(folder, "nc", 0, name);
+        DeleteFileA(name);
+        CreateDirectoryA(name, nullptr);
+        _path = name;
+    }
+
+    TemporaryFolder::~TemporaryFolder() {
+        WIN32_FIND_DATAA entry;
+        const auto search = FindFirstFileA((_path + "\\*").c_str(), &entry);
+        if (search != INVALID_HANDLE_VALUE) {
+            do {
+                if ((entry.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) == 0) DeleteFileA(file(entry.cFileName).c_str());
+            } while (FindNextFileA(search, &entry));
+            FindClose(search);
+        }
+        RemoveDirectoryA(_path.c_str());
+    }
+#else
+    TemporaryFolder::TemporaryFolder() {
+        const auto folder = std::getenv("TMPDIR");
+        std::string pattern = std::string(folder == nullptr || *folder == 0 ? "/tmp" : folder) + "/netconfigXXXXXX";
+        std::vector<char> name(pattern.begin(), pattern.end());
+        name.push_back(0);
+        if (mkdtemp(name.data()) != nullptr) _path = name.data();
+    }
+
+    TemporaryFolder::~TemporaryFolder() {
+        if (_path.empty()) return;
+        if (const auto folder = opendir(_path.c_str())) {
+            while (const auto entry = readdir(folder)) {
+                const std::string name = entry->d_name;
+                if (name != "." && name != "..") std::remove(file(name).c_str());
+            }
+            closedir(folder);
+        }
+        rmdir(_path.c_str());
+    }
+#endif
+
+    const std::string& TemporaryFolder::path() const {
+        return _path;
+    }
+
+    std::string TemporaryFolder::file(const std::string& name) const {
+        return _path + "/" + name;
+    }
+}
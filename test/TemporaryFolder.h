@@ -0,0 +1,33 @@
+// Copyright 2024 Rik Essenius
+// 
+// Licensed under the Apache License, Version 2.0 (the "License"); you may not use this file
+// except in compliance with the License. You may obtain a copy of the License at
+// 
+//     http://www.apache.org/licenses/LICENSE-2.0
+// 
+// Unless required by applicable law or agreed to in writing, software distributed under the License
+// is distributed on an "AS IS" BASIS WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and limitations under the License.
+
+// A new folder in the system's temporary folder for the files a test writes. The destructor removes it with its files.
+
+#ifndef HEADER_TEMPORARY_FOLDER
+#define HEADER_TEMPORARY_FOLDER
+
+#include <string>
+
+namespace Esp32NetConfigCppTest {
+    class TemporaryFolder {
+    public:
+        TemporaryFolder();
+        TemporaryFolder(const TemporaryFolder&) = delete;
+        TemporaryFolder& operator=(const TemporaryFolder&) = delete;
+        ~TemporaryFolder();
+        const std::string& path() const;
+        // The path of a file in the folder
+        std::string file(const std::string& name) const;
+    private:
+        std::string _path;
+    };
+}
+#endif
@@ -0,0 +1,184 @@
+// Copyright 2024 Rik Essenius
+// 
+// Licensed under the Apache License, Version 2.0 (the "License"); you may not use this file
+// except in compliance with the License. You may obtain a copy of the License at
+// 
+//     http://www.apache.org/licenses/LICENSE-2.0
+// 
+// Unless required by applicable law or agreed to in writing, software distributed under the License
+// is distributed on an "AS IS" BASIS WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and limitations under the License.
+
+#include <chrono>
+#include <cstring>
+#include "Preferences.h"
+
+// Like NVS, keys and namespace names are limited to 15 characters, a read-only begin() of a non-existing 
+// namespace fails, and reading a value that does not fit in the target returns 0 without copying.
+
+constexpr size_t MaxNameLength = 15;
+
+namespace {
+    // Busy-waits rather than sleeps: a lookup keeps the CPU busy, so it only overlaps with other work on another core
+    void waitForLookup(const unsigned int microseconds) {
+        if (microseconds == 0) return;
+        const auto end = std::chrono::steady_clock::now() + std::chrono::microseconds(microseconds);
+        while (std::chrono::steady_clock::now() < end) {}
+    }
+}
+
+PreferencesCounters Preferences::_counters{};
+unsigned int Preferences::_lookupDelay = 0;
+
+bool Preferences::begin(const char* name, const bool readOnly, const char*) {
+    _counters.namespaceOpens++;
+    _namespace = nullptr;
+    _readOnly = readOnly;
+    if (name == nullptr || strlen(name) > MaxNameLength) return false;
+    if (readOnly) {
+        const auto entry = storage().find(name);
+        if (entry == storage().end()) return false;
+        _namespace = &entry->second;
+        return true;
+    }
+    _namespace = &storage()[name];
+    return true;
+}
+
+bool Preferences::clear() {
+    if (_namespace == nullptr || _readOnly) return false;
+    _counters.writes++;
+    _namespace->clear();
+    return true;
+}
+
+const PreferencesCounters& Preferences::counters() {
+    return _counters;
+}
+
+void Preferences::end() {
+    _namespace = nullptr;
+}
+
+const Preferences::Entry* Preferences::find(const char* key, const Type type) {
+    _counters.keyLookups++;
+    waitForLookup(_lookupDelay);
+    if (_namespace == nullptr || key == nullptr) return nullptr;
+    const auto entry = _namespace->find(key);
+    if (entry == _namespace->end() || entry->second.type != type) return nullptr;
+    return &entry->second;
+}
+
+size_t Preferences::get(const char* key, const Type type, void* value, const size_t size) {
+    const auto entry = find(key, type);
+    if (entry == nullptr || value == nullptr || entry->value.size() > size) return 0;
+    memcpy(value, entry->value.data(), entry->value.size());
+    _counters.bytesRead += entry->value.size();
+    return entry->value.size();
+}
+
+bool Preferences::getBool(const char* key, const bool defaultValue) {
+    uint8_t value;
+    return get(key, Type::Bool, &value, sizeof value) == 0 ? defaultValue : value != 0;
+}
+
+size_t Preferences::getBytes(const char* key, void* buffer, const size_t maxLength) {
+    return get(key, Type::Bytes, buffer, maxLength);
+}
+
+size_t Preferences::getBytesLength(const char* key) {
+    const auto entry = find(key, Type::Bytes);
+    return entry == nullptr ? 0 : entry->value.size();
+}
+
+String Preferences::getString(const char* key, const String& defaultValue) {
+    const auto entry = find(key, Type::String);
+    if (entry == nullptr) return defaultValue;
+    _counters.bytesRead += entry->value.size();
+    return String(reinterpret_cast<const char*>(entry->value.data()));
+}
+
+size_t Preferences::getString(const char* key, char* value, const size_t maxLength) {
+    return get(key, Type::String, value, maxLength);
+}
+
+uint8_t Preferences::getUChar(const char* key, const uint8_t defaultValue) {
+    uint8_t value;
+    return get(key, Type::UChar, &value, sizeof value) == 0 ? defaultValue : value;
+}
+
+uint32_t Preferences::getUInt(const char* key, const uint32_t defaultValue) {
+    uint32_t value;
+    return get(key, Type::UInt, &value, sizeof value) == 0 ? defaultValue : value;
+}
+
+uint16_t Preferences::getUShort(const char* key, const uint16_t defaultValue) {
+    uint16_t value;
+    return get(key, Type::UShort, &value, sizeof value) == 0 ? defaultValue : value;
+}
+
+bool Preferences::isKey(const char* key) {
+    _counters.keyLookups++;
+    waitForLookup(_lookupDelay);
+    return _namespace != nullptr && key != nullptr && _namespace->count(key) > 0;
+}
+
+size_t Preferences::put(const char* key, const Type type, const void* value, const size_t size) {
+    if (_namespace == nullptr || _readOnly || key == nullptr || strlen(key) > MaxNameLength || value == nullptr) return 0;
+    _counters.writes++;
+    _counters.bytesWritten += size;
+    auto& entry = (*_namespace)[key];
+    entry.type = type;
+    const auto bytes = static_cast<const uint8_t*>(value);
+    entry.value.assign(bytes, bytes + size);
+    return size;
+}
+
+size_t Preferences::putBool(const char* key, const bool value) {
+    const uint8_t byte = value ? 1 : 0;
+    return put(key, Type::Bool, &byte, sizeof byte);
+}
+
+size_t Preferences::putBytes(const char* key, const void* value, const size_t length) {
+    return length == 0 ? 0 : put(key, Type::Bytes, value, length);
+}
+
+size_t Preferences::putString(const char* key, const char* value) {
+    return value == nullptr ? 0 : put(key, Type::String, value, strlen(value) + 1);
+}
+
+size_t Preferences::putUChar(const char* key, const uint8_t value) {
+    return put(key, Type::UChar, &value, sizeof value);
+}
+
+size_t Preferences::putUInt(const char* key, const uint32_t value) {
+    return put(key, Type::UInt, &value, sizeof value);
+}
+
+size_t Preferences::putUShort(const char* key, const uint16_t value) {
+    return put(key, Type::UShort, &value, sizeof value);
+}
+
+bool Preferences::remove(const char* key) {
+    if (_namespace == nullptr || _readOnly || key == nullptr) return false;
+    if (_namespace->erase(key) == 0) return false;
+    _counters.writes++;
+    return true;
+}
+
+void Preferences::reset() {
+    storage().clear();
+}
+
+void Preferences::resetCounters() {
+    _counters = PreferencesCounters{};
+}
+
+void Preferences::setLookupDelay(const unsigned int microseconds) {
+    _lookupDelay = microseconds;
+}
+
+std::map<std::string, Preferences::Namespace>& Preferences::storage() {
+    static std::map<std::string, Namespace> storage;
+    return storage;
+}
@@ -0,0 +1,80 @@
+// Copyright 2024 Rik Essenius
+// 
+// Licensed under the Apache License, Version 2.0 (the "License"); you may not use this file
+// except in compliance with the License. You may obtain a copy of the License at
+// 
+//     http://www.apache.org/licenses/LICENSE-2.0
+// 
+// Unless required by applicable law or agreed to in writing, software distributed under the License
+// is distributed on an "AS IS" BASIS WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and limitations under the License.
+
+// Instrumented stand-in for Preferences, used by the benchmark instead of the one in esp32-mock.
+// Preferences methods are not virtual, so we can't intercept calls by deriving from it. Instead, the benchmark compiles
+// the library sources with this folder first on the include path. It keeps the data in memory like the mock does,
+// and counts the NVS operations so the benchmark can report them. It can also simulate the time NVS takes to look up a key.
+
+#ifndef HEADER_PREFERENCES
+#define HEADER_PREFERENCES
+
+#include <Arduino.h>
+#include <map>
+#include <string>
+#include <vector>
+
+struct PreferencesCounters {
+    size_t namespaceOpens;
+    size_t keyLookups;
+    size_t writes;
+    size_t bytesRead;
+    size_t bytesWritten;
+};
+
+class Preferences {
+public:
+    bool begin(const char* name, bool readOnly = false, const char* partitionLabel = nullptr);
+    void end();
+    bool clear();
+    bool remove(const char* key);
+    bool isKey(const char* key);
+
+    bool getBool(const char* key, bool defaultValue = false);
+    size_t getBytes(const char* key, void* buffer, size_t maxLength);
+    size_t getBytesLength(const char* key);
+    String getString(const char* key, const String& defaultValue = String());
+    size_t getString(const char* key, char* value, size_t maxLength);
+    uint8_t getUChar(const char* key, uint8_t defaultValue = 0);
+    uint32_t getUInt(const char* key, uint32_t defaultValue = 0);
+    uint16_t getUShort(const char* key, uint16_t defaultValue = 0);
+
+    size_t putBool(const char* key, bool value);
+    size_t putBytes(const char* key, const void* value, size_t length);
+    size_t putString(const char* key, const char* value);
+    size_t putUChar(const char* key, uint8_t value);
+    size_t putUInt(const char* key, uint32_t value);
+    size_t putUShort(const char* key, uint16_t value);
+
+    static void reset();
+    static const PreferencesCounters& counters();
+    static void resetCounters();
+    // Every key lookup takes at least this long (0 by default). Busy-waits, as reading flash keeps the CPU busy.
+    static void setLookupDelay(unsigned int microseconds);
+
+private:
+    enum class Type : uint8_t { Bool, Bytes, String, UChar, UInt, UShort };
+    struct Entry {
+        Type type;
+        std::vector<uint8_t> value;
+    };
+    using Namespace = std::map<std::string, Entry>;
+    const Entry* find(const char* key, Type type);
+    size_t get(const char* key, Type type, void* value, size_t size);
+    size_t put(const char* key, Type type, const void* value, size_t size);
+    static std::map<std::string, Namespace>& storage();
+    static PreferencesCounters _counters;
+    static unsigned int _lookupDelay;
+    Namespace* _namespace = nullptr;
+    bool _readOnly = true;
+};
+
+#endif
@@ -0,0 +1,135 @@
+// Copyright 2024 Rik Essenius
+//
+// Licensed under the Apache License, Version 2.0 (the "License"); you may not use this file
+// except in compliance with the License. You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software distributed under the License
+// is distributed on an "AS IS" BASIS WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and limitations under the License.
+
+#include <algorithm>
+#include <atomic>
+#include <deque>
+#include <fstream>
+#include <mutex>
+#include <sstream>
+#include <thread>
+#include "Configuration.h"
+#include "ConfigurationKeys.h"
+#include "ImageGenerator.h"
+
+namespace Esp32NetConfig {
+
+    constexpr auto IdColumn = "id";
+    constexpr auto FileMarker = '@';
+    constexpr uint8_t ErasedFlash = 0xFF;
+
+    // The id is the file name, so it must not lead out of the output folder
+    bool isValidId(const std::string& id) {
+        return id.find_first_of("/\\") == std::string::npos && id.find("..") == std::string::npos;
+    }
+
+    ImageGenerator::ImageGenerator(const size_t partitionSize, std::string baseFolder) :
+        _partitionSize(partitionSize), _baseFolder(std::move(baseFolder)) {}
+
+    bool ImageGenerator::build(const Manifest::Device& device, std::vector<uint8_t>& image, std::string& error) const {
+        IpConfig ip{};
+        WifiConfig wifi{};
+        TlsConfig tls{};
+        MqttConfig mqtt{};
+        FirmwareConfig firmware{};
+        void* const sections[] = { &ip, &wifi, &tls, &mqtt, &firmware };
+        uint8_t bssid[BssidSize];
+        // the values from files; a deque keeps them where they are when it grows
+        std::deque<std::string> files;
+
+        for (const auto& entry : device) {
+            const auto& column = entry.first;
+            const auto& value = entry.second;
+            if (column == IdColumn || value.empty()) continue;
+            const auto number = findField(column.c_str());
+            if (number == BuiltInFieldCount) {
+                error = "unknown column " + column;
+                return false;
+            }
+            const auto& field = BuiltInFields[number];
+            const auto member = static_cast<char*>(sections[sectionOf(number)]) + field.offset;
+            auto text = value.c_str();
+            const bool isText = field.type == FieldType::String || field.type == FieldType::Certificate;
+            if (isText && value[0] == FileMarker) {
+                files.emplace_back();
+                if (!readFile(value.substr(1), files.back())) {
+                    error = column + ": cannot read " + value.substr(1);
+                    return false;
+                }
+                text = files.back().c_str();
+            }
+            if (!parseField(number, text, member, bssid)) {
+                error = column + ": invalid value " + value;
+                return false;
+            }
+        }
+        if (!Configuration::buildImage(ip, wifi, tls, mqtt, firmware, image)) {
+            error = "a value is longer than " + std::to_string(Configuration::MaxPackedStringLength) + " characters";
+            return false;
+        }
+        if (_partitionSize == 0) return true;
+        if (image.size() > _partitionSize) {
+            error = "image of " + std::to_string(image.size()) + " bytes does not fit in the partition";
+            return false;
+        }
+        image.resize(_partitionSize, ErasedFlash);
+        return true;
+    }
+
+    size_t ImageGenerator::generate(const Manifest& manifest, const std::string& outputFolder, unsigned int threadCount,
+                                    std::vector<std::string>& errors) const {
+        if (threadCount == 0) threadCount = std::max(1u, std::thread::hardware_concurrency());
+        const auto& devices = manifest.devices();
+        std::atomic<size_t> next{ 0 };
+        std::atomic<size_t> written{ 0 };
+        std::mutex errorMutex;
+        auto worker = [&]() {
+            std::vector<uint8_t> image;
+            std::string error;
+            for (auto index = next++; index < devices.size(); index = next++) {
+                const auto id = devices[index].find(IdColumn);
+                if (id == devices[index].end() || id->second.empty()) {
+                    error = "no id";
+                }
+                else if (!isValidId(id->second)) {
+                    error = "invalid id " + id->second;
+                }
+                else if (build(devices[index], image, error)) {
+                    const auto path = outputFolder + "/" + id->second + ".bin";
+                    std::ofstream file(path, std::ios::binary);
+                    file.write(reinterpret_cast<const char*>(image.data()), static_cast<std::streamsize>(image.size()));
+                    if (file) {
+                        ++written;
+                        continue;
+                    }
+                    error = "cannot write " + path;
+                }
+                std::lock_guard<std::mutex> lock(errorMutex);
+                errors.push_back("device " + std::to_string(index + 1) + ": " + error);
+            }
+        };
+        std::vector<std::thread> threads;
+        for (unsigned int i = 1; i < threadCount; i++) threads.emplace_back(worker);
+        worker();
+        for (auto& thread : threads) thread.join();
+        return written;
+    }
+
+    bool ImageGenerator::readFile(const std::string& name, std::string& content) const {
+        const auto path = _baseFolder.empty() || name[0] == '/' ? name : _baseFolder + "/" + name;
+        std::ifstream file(path, std::ios::binary);
+        if (!file) return false;
+        std::stringstream text;
+        text << file.rdbuf();
+        content = text.str();
+        return true;
+    }
+}
@@ -0,0 +1,43 @@
+// Copyright 2024 Rik Essenius
+//
+// Licensed under the Apache License, Version 2.0 (the "License"); you may not use this file
+// except in compliance with the License. You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software distributed under the License
+// is distributed on an "AS IS" BASIS WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and limitations under the License.
+
+// Builds configuration images (see ConfigurationImage) for the devices in a manifest, on all cores.
+// Values are parsed by the field type of their column: addresses as a.b.c.d, a BSSID as six hex bytes separated by
+// colons, booleans as true/false or 1/0. A string that starts with @ is the name of a file to read it from, e.g. a
+// certificate. Empty values are not set.
+
+#ifndef HEADER_IMAGE_GENERATOR
+#define HEADER_IMAGE_GENERATOR
+
+#include <string>
+#include <vector>
+#include "Manifest.h"
+
+namespace Esp32NetConfig {
+    class ImageGenerator {
+    public:
+        // With a partition size, the images are padded with 0xFF (erased flash) to that size, so they can be
+        // flashed over the whole partition. Relative file names in values are relative to 'baseFolder'.
+        explicit ImageGenerator(size_t partitionSize = 0, std::string baseFolder = std::string());
+        // Returns false with the reason in 'error' if a column or a value is invalid, or the image is too large.
+        bool build(const Manifest::Device& device, std::vector<uint8_t>& image, std::string& error) const;
+        // Writes <outputFolder>/<id>.bin for every device, using 'threadCount' threads (0: one per core).
+        // An id with a path separator or .. is an error, so all images end up in the output folder.
+        // Returns the number of images written; 'errors' gets a line per device that failed.
+        size_t generate(const Manifest& manifest, const std::string& outputFolder, unsigned int threadCount,
+                        std::vector<std::string>& errors) const;
+    private:
+        size_t _partitionSize;
+        std::string _baseFolder;
+        bool readFile(const std::string& name, std::string& content) const;
+    };
+}
+#endif
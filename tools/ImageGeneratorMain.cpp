@@ -0,0 +1,63 @@
+// Copyright 2024 Rik Essenius
+//
+// Licensed under the Apache License, Version 2.0 (the "License"); you may not use this file
+// except in compliance with the License. You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software distributed under the License
+// is distributed on an "AS IS" BASIS WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and limitations under the License.
+
+// Generates a configuration image per device in a manifest, to flash into the partition that ConfigurationImage maps.
+// Usage: <program> manifest.csv|manifest.json outputFolder [--partition-size bytes] [--threads count]
+// File names in the manifest (@file) are relative to the folder of the manifest.
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include "ImageGenerator.h"
+#include "Manifest.h"
+
+using Esp32NetConfig::ImageGenerator;
+using Esp32NetConfig::Manifest;
+
+int main(const int argc, char* argv[]) {
+    if (argc < 3) {
+        fprintf(stderr, "Usage: %s manifest.csv|manifest.json outputFolder [--partition-size bytes] [--threads count]\n", argv[0]);
+        return 2;
+    }
+    size_t partitionSize = 0;
+    unsigned int threadCount = 0;
+    for (int i = 3; i + 1 < argc; i += 2) {
+        if (strcmp(argv[i], "--partition-size") == 0) {
+            partitionSize = strtoul(argv[i + 1], nullptr, 0);
+        }
+        else if (strcmp(argv[i], "--threads") == 0) {
+            threadCount = static_cast<unsigned int>(strtoul(argv[i + 1], nullptr, 10));
+        }
+        else {
+            fprintf(stderr, "Unknown option %s\n", argv[i]);
+            return 2;
+        }
+    }
+
+    Manifest manifest;
+    if (!manifest.load(argv[1])) {
+        fprintf(stderr, "%s: %s\n", argv[1], manifest.error().c_str());
+        return 1;
+    }
+    const std::string manifestPath(argv[1]);
+    const auto slash = manifestPath.find_last_of("/\\");
+    const ImageGenerator generator(partitionSize, slash == std::string::npos ? std::string() : manifestPath.substr(0, slash));
+
+    std::vector<std::string> errors;
+    const auto start = std::chrono::steady_clock::now();
+    const auto written = generator.generate(manifest, argv[2], threadCount, errors);
+    const auto seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    for (const auto& error : errors) fprintf(stderr, "%s\n", error.c_str());
+    printf("%zu of %zu images written in %.3f s\n", written, manifest.devices().size(), seconds);
+    return errors.empty() ? 0 : 1;
+}
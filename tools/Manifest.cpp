@@ -0,0 +1,219 @@
+// Copyright 2024 Rik Essenius
+//
+// Licensed under the Apache License, Version 2.0 (the "License"); you may not use this file
+// except in compliance with the License. You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software distributed under the License
+// is distributed on an "AS IS" BASIS WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and limitations under the License.
+
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include "Manifest.h"
+
+namespace Esp32NetConfig {
+
+    bool Manifest::load(const char* path) {
+        std::ifstream file(path, std::ios::binary);
+        if (!file) return fail(std::string("cannot read ") + path);
+        std::stringstream text;
+        text << file.rdbuf();
+        const auto length = strlen(path);
+        const bool isJson = length >= 5 && strcmp(path + length - 5, ".json") == 0;
+        return isJson ? parseJson(text.str()) : parseCsv(text.str());
+    }
+
+    const std::vector<Manifest::Device>& Manifest::devices() const {
+        return _devices;
+    }
+
+    const std::string& Manifest::error() const {
+        return _error;
+    }
+
+    bool Manifest::fail(const std::string& message) {
+        _devices.clear();
+        _error = message;
+        return false;
+    }
+
+    bool Manifest::parseCsv(const std::string& text) {
+        // RFC 4180: fields in double quotes can contain commas, line breaks and doubled quotes
+        _devices.clear();
+        _error.clear();
+        std::vector<std::string> header;
+        std::vector<std::string> fields(1);
+        bool isQuoted = false;
+        size_t line = 1;
+        auto endRecord = [&]() -> bool {
+            const bool isEmpty = fields.size() == 1 && fields[0].empty();
+            if (!isEmpty) {
+                if (header.empty()) {
+                    header = fields;
+                }
+                else if (fields.size() != header.size()) {
+                    return fail("line " + std::to_string(line) + ": expected " + std::to_string(header.size()) + " fields");
+                }
+                else {
+                    Device device;
+                    for (size_t i = 0; i < header.size(); i++) device[header[i]] = fields[i];
+                    _devices.push_back(device);
+                }
+            }
+            fields.assign(1, std::string());
+            return true;
+        };
+        for (size_t position = 0; position < text.size(); position++) {
+            const auto character = text[position];
+            if (isQuoted) {
+                if (character != '"') {
+                    if (character == '\n') line++;
+                    fields.back() += character;
+                }
+                else if (position + 1 < text.size() && text[position + 1] == '"') {
+                    fields.back() += '"';
+                    position++;
+                }
+                else {
+                    isQuoted = false;
+                }
+            }
+            else if (character == '"') {
+                isQuoted = true;
+            }
+            else if (character == ',') {
+                fields.emplace_back();
+            }
+            else if (character == '\n') {
+                if (!endRecord()) return false;
+                line++;
+            }
+            else if (character != '\r') {
+                fields.back() += character;
+            }
+        }
+        if (isQuoted) return fail("line " + std::to_string(line) + ": unterminated quote");
+        if (!endRecord()) return false;
+        if (header.empty()) return fail("no header");
+        return true;
+    }
+
+    bool Manifest::parseJson(const std::string& text) {
+        _devices.clear();
+        _error.clear();
+        size_t position = 0;
+        skipWhitespace(text, position);
+        if (position >= text.size() || text[position] != '[') return fail("expected an array");
+        position++;
+        skipWhitespace(text, position);
+        if (position < text.size() && text[position] == ']') return true;
+        while (position < text.size()) {
+            Device device;
+            if (!parseJsonObject(text, position, device)) return false;
+            _devices.push_back(device);
+            skipWhitespace(text, position);
+            if (position < text.size() && text[position] == ',') {
+                position++;
+                skipWhitespace(text, position);
+                continue;
+            }
+            if (position < text.size() && text[position] == ']') return true;
+            break;
+        }
+        return fail("offset " + std::to_string(position) + ": expected ',' or ']'");
+    }
+
+    bool Manifest::parseJsonObject(const std::string& text, size_t& position, Device& device) {
+        if (position >= text.size() || text[position] != '{') return fail("offset " + std::to_string(position) + ": expected an object");
+        position++;
+        skipWhitespace(text, position);
+        if (position < text.size() && text[position] == '}') {
+            position++;
+            return true;
+        }
+        while (position < text.size()) {
+            std::string name;
+            if (!parseJsonString(text, position, name)) return false;
+            skipWhitespace(text, position);
+            if (position >= text.size() || text[position] != ':') return fail("offset " + std::to_string(position) + ": expected ':'");
+            position++;
+            skipWhitespace(text, position);
+            if (!parseJsonValue(text, position, device[name])) return false;
+            skipWhitespace(text, position);
+            if (position < text.size() && text[position] == ',') {
+                position++;
+                skipWhitespace(text, position);
+                continue;
+            }
+            if (position < text.size() && text[position] == '}') {
+                position++;
+                return true;
+            }
+            break;
+        }
+        return fail("offset " + std::to_string(position) + ": expected ',' or '}'");
+    }
+
+    bool Manifest::parseJsonString(const std::string& text, size_t& position, std::string& value) {
+        if (position >= text.size() || text[position] != '"') return fail("offset " + std::to_string(position) + ": expected a string");
+        position++;
+        value.clear();
+        while (position < text.size() && text[position] != '"') {
+            auto character = text[position++];
+            if (character == '\\') {
+                if (position >= text.size()) break;
+                character = text[position++];
+                switch (character) {
+                case 'b': character = '\b'; break;
+                case 'f': character = '\f'; break;
+                case 'n': character = '\n'; break;
+                case 'r': character = '\r'; break;
+                case 't': character = '\t'; break;
+                case 'u': {
+                    // enough for the characters in settings: no surrogate pairs
+                    if (position + 4 > text.size()) return fail("offset " + std::to_string(position) + ": incomplete \\u escape");
+                    const auto code = strtoul(text.substr(position, 4).c_str(), nullptr, 16);
+                    position += 4;
+                    if (code < 0x80) {
+                        value += static_cast<char>(code);
+                    }
+                    else if (code < 0x800) {
+                        value += static_cast<char>(0xC0 | code >> 6);
+                        value += static_cast<char>(0x80 | (code & 0x3F));
+                    }
+                    else {
+                        value += static_cast<char>(0xE0 | code >> 12);
+                        value += static_cast<char>(0x80 | (code >> 6 & 0x3F));
+                        value += static_cast<char>(0x80 | (code & 0x3F));
+                    }
+                    continue;
+                }
+                default: break; // '"', '\\' and '/' are themselves
+                }
+            }
+            value += character;
+        }
+        if (position >= text.size()) return fail("unterminated string");
+        position++;
+        return true;
+    }
+
+    bool Manifest::parseJsonValue(const std::string& text, size_t& position, std::string& value) {
+        // numbers, true and false are kept as their text; null is the same as leaving the setting out
+        if (position < text.size() && text[position] == '"') return parseJsonString(text, position, value);
+        const auto start = position;
+        while (position < text.size() && strchr(",}] \t\r\n", text[position]) == nullptr) position++;
+        value = text.substr(start, position - start);
+        if (value.empty()) return fail("offset " + std::to_string(start) + ": expected a value");
+        if (value == "null") value.clear();
+        return true;
+    }
+
+    void Manifest::skipWhitespace(const std::string& text, size_t& position) {
+        while (position < text.size() && strchr(" \t\r\n", text[position]) != nullptr) position++;
+    }
+}
@@ -0,0 +1,45 @@
+// Copyright 2024 Rik Essenius
+//
+// Licensed under the Apache License, Version 2.0 (the "License"); you may not use this file
+// except in compliance with the License. You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software distributed under the License
+// is distributed on an "AS IS" BASIS WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and limitations under the License.
+
+// The per-device settings for the image generator. A CSV manifest has a header row with the column names and a row per
+// device; a JSON manifest is an array with a flat object per device. The names are 'id' (the name of the image) and
+// <namespace>.<key> as in Preferences, e.g. wifi.ssid, mqtt.port or tls.rootCaCert.
+
+#ifndef HEADER_MANIFEST
+#define HEADER_MANIFEST
+
+#include <map>
+#include <string>
+#include <vector>
+
+namespace Esp32NetConfig {
+    class Manifest {
+    public:
+        using Device = std::map<std::string, std::string>;
+
+        // Reads a .json file as JSON, and anything else as CSV
+        bool load(const char* path);
+        bool parseCsv(const std::string& text);
+        bool parseJson(const std::string& text);
+        const std::vector<Device>& devices() const;
+        // Why the last load or parse failed
+        const std::string& error() const;
+    private:
+        bool fail(const std::string& message);
+        bool parseJsonObject(const std::string& text, size_t& position, Device& device);
+        bool parseJsonString(const std::string& text, size_t& position, std::string& value);
+        bool parseJsonValue(const std::string& text, size_t& position, std::string& value);
+        static void skipWhitespace(const std::string& text, size_t& position);
+        std::vector<Device> _devices;
+        std::string _error;
+    };
+}
+#endif